@@ -89,6 +89,8 @@
         (test = (ilog2 1)               0)
         (test = (ilog2 5)               2)
         (test = (ilog2 8)               3)
+        (test = (hash "hello")          261238937)
+        (test = (crc "hello")           907060870)
         (test = (is-utf8 "∀x∈ℝ: ⌈x⌉ = −⌊−x⌋") t)
         (test = (is-utf8 "α ∧ ¬β = ¬(¬α ∨ β)") t)
         (test = (is-utf8 "ℕ ⊆ ℕ₀ ⊂ ℤ ⊂ ℚ ⊂ ℝ ⊂ ℂ") t)
@@ -104,7 +106,7 @@
         (coerce *string* 1.0) 
          "1\\.0*")
     (test = (cdr (assoc 'x '((x . a) (y . b)))) 'a)
-    (test = (eval 'x '((x a) (y b))) '(a))
+    (test equal (eval 'x '((x a) (y b))) '(a))
     (test equal (pair '(x y z) '(a b c)) '((x a) (y b) (z c)))
     (test equal (list 'a 'b 'c) '(a b c))
     (test equal (subst 'm 'b '(a b (a b c) d)) '(a m (a m c) d))
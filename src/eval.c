@@ -16,63 +16,69 @@
 
 static const int dynamic_on = 0; /**< 0 for lexical scoping, !0 for dynamic scoping*/
 
-/**@brief make new lisp cells and perform garbage bookkeeping/collection*/
-static lisp_cell_t *mk(lisp_t * l, lisp_type type, size_t count, ...) {
+/**@brief make a new lisp cell with its fields zeroed and perform garbage
+ * bookkeeping/collection*/
+static lisp_cell_t *mk_cell(lisp_t * l, lisp_type type, size_t count) {
 	assert(l && type != INVALID && count);
 	lisp_cell_t *ret;
-	gc_list_t *node; /**< new node in linked list of all allocations*/
+
+	if (l->gc_bytes >= l->gc_threshold)
+		lisp_gc_collect(l);
+
+	ret = lisp_gc_alloc(l, type, count);
+	l->gc_stats.allocated[type]++;
+	lisp_gc_add(l, ret);
+	return ret;
+}
+
+/**@brief make new lisp cells with their fields filled in*/
+static lisp_cell_t *mk(lisp_t * l, lisp_type type, size_t count, ...) {
+	lisp_cell_t *ret = mk_cell(l, type, count);
 	va_list ap;
 	size_t i;
 
-	if (l->gc_collectp++ > COLLECTION_POINT)	/*set to 1 for testing */
-		lisp_gc_mark_and_sweep(l);
-
 	va_start(ap, count);
-	ret  = lisp_calloc(l, sizeof(lisp_cell_t) + (count - 1) * sizeof(cell_data_t));
-	node = lisp_calloc(l, sizeof(*node));
-	ret->type = type;
 	for (i = 0; i < count; i++)
 		if (FLOAT == type)
 			ret->p[i].f = va_arg(ap, double);
-		else if (SUBR == type)
-			ret->p[i].prim = va_arg(ap, lisp_subr_func);
 		else
 			ret->p[i].v = va_arg(ap, void *);
 	va_end(ap);
-	node->ref = ret;
-	node->next = l->gc_head;
-	l->gc_head = node;
-	lisp_gc_add(l, ret);
 	return ret;
 }
 
 lisp_cell_t *cons(lisp_t * l, lisp_cell_t * x, lisp_cell_t * y) {
 	assert(l);
-	return mk(l, CONS, 2, x, y);
+	lisp_cell_t *ret = mk_cell(l, CONS, 2);
+	CONS_FIELDS(ret)[0].v = x;
+	CONS_FIELDS(ret)[1].v = y;
+	return ret;
 }
 
 lisp_cell_t *car(lisp_cell_t * con) {
 	assert(con && is_cons(con));
-	return con->p[0].v;
+	return CONS_FIELDS(con)[0].v;
 }
 
 lisp_cell_t *cdr(lisp_cell_t * con) {
 	assert(con && is_cons(con));
-	return con->p[1].v;
+	return CONS_FIELDS(con)[1].v;
 }
 
 void set_car(lisp_cell_t * con, lisp_cell_t * val) {
 	assert(con && is_cons(con) && val);
-	con->p[0].v = val;
+	CONS_FIELDS(con)[0].v = val;
+	lisp_gc_write_barrier(con);
 }
 
 void set_cdr(lisp_cell_t * con, lisp_cell_t * val) {
 	assert(con && is_cons(con) && val);
-	con->p[1].v = val;
+	CONS_FIELDS(con)[1].v = val;
+	lisp_gc_write_barrier(con);
 }
 
 void close_cell(lisp_cell_t * x) {
-	assert(x);
+	assert(x && HAS_HEADER(x));
 	x->close = 1;
 }
 
@@ -88,22 +94,22 @@ int is_nil(lisp_cell_t * x) {
 
 int is_int(lisp_cell_t * x) {
 	assert(x);
-	return x->type == INTEGER;
+	return TYPE(x) == INTEGER;
 }
 
 int is_floating(lisp_cell_t * x) {
 	assert(x);
-	return x->type == FLOAT;
+	return TYPE(x) == FLOAT;
 }
 
 int is_io(lisp_cell_t * x) {
 	assert(x);
-	return x->type == IO && !x->close;
+	return TYPE(x) == IO && !x->close;
 }
 
 int is_cons(lisp_cell_t * x) {
 	assert(x);
-	return x->type == CONS;
+	return TYPE(x) == CONS;
 }
 
 int is_proper_cons(lisp_cell_t * x) {
@@ -113,42 +119,52 @@ int is_proper_cons(lisp_cell_t * x) {
 
 int is_proc(lisp_cell_t * x) {
 	assert(x);
-	return x->type == PROC;
+	return TYPE(x) == PROC;
 }
 
 int is_fproc(lisp_cell_t * x) {
 	assert(x);
-	return x->type == FPROC;
+	return TYPE(x) == FPROC;
 }
 
 int is_str(lisp_cell_t * x) {
 	assert(x);
-	return x->type == STRING;
+	return TYPE(x) == STRING;
 }
 
 int is_sym(lisp_cell_t * x) {
 	assert(x);
-	return x->type == SYMBOL;
+	return TYPE(x) == SYMBOL;
+}
+
+int is_vsubr(lisp_cell_t * x) {
+	assert(x);
+	return TYPE(x) == SUBR && x->argv;
 }
 
 int is_subr(lisp_cell_t * x) {
 	assert(x);
-	return x->type == SUBR;
+	return TYPE(x) == SUBR;
 }
 
 int is_hash(lisp_cell_t * x) {
 	assert(x);
-	return x->type == HASH;
+	return TYPE(x) == HASH;
 }
 
 int is_userdef(lisp_cell_t * x) {
 	assert(x);
-	return x->type == USERDEF && !x->close;
+	return TYPE(x) == USERDEF && !x->close;
 }
 
 int is_usertype(lisp_cell_t * x, const int type) {
 	assert(x && type < MAX_USER_TYPES && type >= 0);
-	return x->type == USERDEF && get_user_type(x) == type && !x->close;
+	return TYPE(x) == USERDEF && get_user_type(x) == type && !x->close;
+}
+
+int is_frame(lisp_cell_t * x) {
+	assert(x);
+	return TYPE(x) == FRAME;
 }
 
 int is_asciiz(lisp_cell_t * x) {
@@ -168,7 +184,7 @@ int is_func(lisp_cell_t * x) {
 
 int is_closed(lisp_cell_t * x) {
 	assert(x);
-	return x->close;
+	return HAS_HEADER(x) && x->close;
 }
 
 int is_list(lisp_cell_t * x) {
@@ -185,8 +201,11 @@ static lisp_cell_t *mk_asciiz(lisp_t * l, char *s, lisp_type type) {
 	return x;
 }
 
+/**@brief make a symbol, the third field is its global value cell, the
+ * (symbol . value) pair it is bound to in the top level environment*/
 static lisp_cell_t *mk_sym(lisp_t * l, char *s) {
-	return mk_asciiz(l, s, SYMBOL);
+	assert(l && s);
+	return mk(l, SYMBOL, 3, (lisp_cell_t *) s, strlen(s), NULL);
 }
 
 lisp_cell_t *mk_list(lisp_t * l, lisp_cell_t * x, ...) {
@@ -201,8 +220,18 @@ lisp_cell_t *mk_list(lisp_t * l, lisp_cell_t * x, ...) {
 	return head;
 }
 
+lisp_cell_t *lisp_argv_list(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	assert(l && (argv || !argc));
+	lisp_cell_t *ret = l->nil;
+	while (argc--)
+		ret = cons(l, argv[argc], ret);
+	return ret;
+}
+
 lisp_cell_t *mk_int(lisp_t * l, const intptr_t d) {
 	assert(l);
+	if (d >= FIXNUM_MIN && d <= FIXNUM_MAX)
+		return MK_FIXNUM(d);
 	return mk(l, INTEGER, 1, (lisp_cell_t *) d);
 }
 
@@ -211,27 +240,51 @@ lisp_cell_t *mk_io(lisp_t * l, io_t * x) {
 	return mk(l, IO, 1, (lisp_cell_t *) x);
 }
 
-lisp_cell_t *mk_subr(lisp_t * l, lisp_subr_func p, const char *fmt, const char *doc) {
-	assert(l && p);
-	lisp_cell_t *t = mk(l, SUBR, 4, p, NULL, NULL, NULL);
+/**@brief make a subroutine, its validation string is compiled into type
+ * masks that are kept after the other fields if there is room for them*/
+static lisp_cell_t *mk_subr_cell(lisp_t * l, const char *fmt, const char *doc) {
+	size_t tlen = 0, masks = 0;
 	if (fmt) {
-		size_t tlen = lisp_validate_arg_count(fmt);
+		tlen = lisp_validate_arg_count(fmt);
 		assert((BITS_IN_LENGTH >= 32) && tlen < 0xFFFFFFFFu);
-		t->p[3].v = (void*)tlen;
+		if (tlen <= GC_MAX_FIELDS - SUBR_HEADER)
+			masks = tlen;
 	}
-	t->p[1].v = (void *)fmt;
-	t->p[2].v = (void *)mk_str(l, lisp_strdup(l, doc ? doc : ""));
-	return t;
+	/*the doc string is made first, so no allocation happens between
+	 *making the subroutine and filling it in*/
+	lisp_cell_t *d = mk_str(l, lisp_strdup(l, doc ? doc : ""));
+	lisp_cell_t *ret = mk_cell(l, SUBR, SUBR_HEADER + masks);
+	ret->p[1].v = (void *)fmt;
+	ret->p[2].v = d;
+	ret->p[3].v = (void *)tlen;
+	if (fmt && tlen == masks && lisp_validate_compile(fmt, ret->p + SUBR_HEADER, masks))
+		ret->p[4].v = ret->p + SUBR_HEADER;
+	return ret;
+}
+
+lisp_cell_t *mk_subr(lisp_t * l, lisp_subr_func p, const char *fmt, const char *doc) {
+	assert(l && p);
+	lisp_cell_t *ret = mk_subr_cell(l, fmt, doc);
+	ret->p[0].prim = p;
+	return ret;
+}
+
+lisp_cell_t *mk_vsubr(lisp_t * l, lisp_vsubr_func p, const char *fmt, const char *doc) {
+	assert(l && p);
+	lisp_cell_t *ret = mk_subr_cell(l, fmt, doc);
+	ret->p[0].vprim = p;
+	ret->argv = 1;
+	return ret;
 }
 
 lisp_cell_t *mk_proc(lisp_t * l, lisp_cell_t * args, lisp_cell_t * code, lisp_cell_t * env, lisp_cell_t * doc) {
 	assert(l && args && code && env);
-	return mk(l, PROC, 5, args, code, env, NULL, doc);
+	return mk(l, PROC, 6, args, code, env, NULL, doc, NULL);
 }
 
 lisp_cell_t *mk_fproc(lisp_t * l, lisp_cell_t * args, lisp_cell_t * code, lisp_cell_t * env, lisp_cell_t * doc) {
 	assert(l && args && code && env);
-	return mk(l, FPROC, 5, args, code, env, NULL, doc);
+	return mk(l, FPROC, 6, args, code, env, NULL, doc, NULL);
 }
 
 lisp_cell_t *mk_float(lisp_t * l, lisp_float_t f) {
@@ -250,6 +303,10 @@ lisp_cell_t *mk_immutable_str(lisp_t * l, const char *s) {
 	return r;
 }
 
+lisp_cell_t *mk_code(lisp_t * l, void *code, lisp_cell_t * consts) {
+	return mk(l, CODE, 2, code, consts);
+}
+
 lisp_cell_t *mk_hash(lisp_t * l, hash_table_t * h) {
 	return mk(l, HASH, 1, (lisp_cell_t *) h);
 }
@@ -266,7 +323,7 @@ unsigned get_length(lisp_cell_t * x) {
 	assert(x);
 	if (is_nil(x))
 		return 0;
-	switch (x->type) {
+	switch (TYPE(x)) {
 	case STRING:
 	case SYMBOL:
 		return (uintptr_t)(x->p[1].v);
@@ -283,18 +340,30 @@ unsigned get_length(lisp_cell_t * x) {
 
 void *get_raw(lisp_cell_t * x) {
 	assert(x);
-	return x->p[0].v;
+	return IS_FIXNUM(x) ? (void *)GET_FIXNUM(x) : CELL_FIELDS(x)[0].v;
 }
 
 intptr_t get_int(lisp_cell_t * x) {
-	return !x ? 0 : (intptr_t) (x->p[0].v);
+	if (!x)
+		return 0;
+	return IS_FIXNUM(x) ? GET_FIXNUM(x) : (intptr_t) (CELL_FIELDS(x)[0].v);
 }
 
 lisp_subr_func get_subr(lisp_cell_t * x) {
-	assert(x && is_subr(x));
+	assert(x && is_subr(x) && !x->argv);
 	return x->p[0].prim;
 }
 
+lisp_vsubr_func get_vsubr(lisp_cell_t * x) {
+	assert(x && is_vsubr(x));
+	return x->p[0].vprim;
+}
+
+cell_data_t *get_subr_masks(lisp_cell_t * x) {
+	assert(x && is_subr(x));
+	return x->p[4].v;
+}
+
 lisp_cell_t *get_proc_args(lisp_cell_t * x) {
 	assert(x && (is_proc(x) || is_fproc(x)));
 	return x->p[0].v;
@@ -310,6 +379,11 @@ lisp_cell_t *get_proc_env(lisp_cell_t * x) {
 	return x->p[2].v;
 }
 
+lisp_cell_t *get_proc_bytecode(lisp_cell_t * x) {
+	assert(x && (is_proc(x) || is_fproc(x)));
+	return x->p[5].v;
+}
+
 lisp_cell_t *get_func_docstring(lisp_cell_t * x) {
 	assert(x && is_func(x));
 	return is_subr(x) ? x->p[2].v : x->p[4].v;
@@ -321,7 +395,7 @@ char *get_func_format(lisp_cell_t * x) {
 }
 
 io_t *get_io(lisp_cell_t * x) {
-	assert(x && x->type == IO);
+	assert(x && TYPE(x) == IO);
 	return (io_t *) (x->p[0].v);
 }
 
@@ -336,12 +410,12 @@ char *get_str(lisp_cell_t * x) {
 }
 
 void *get_user(lisp_cell_t * x) {
-	assert(x && x->type == USERDEF);
+	assert(x && TYPE(x) == USERDEF);
 	return (void *)(x->p[0].v);
 }
 
 int get_user_type(lisp_cell_t * x) {
-	assert(x && x->type == USERDEF);
+	assert(x && TYPE(x) == USERDEF);
 	return (intptr_t) x->p[1].v;
 }
 
@@ -350,6 +424,202 @@ hash_table_t *get_hash(lisp_cell_t * x) {
 	return (hash_table_t *) (x->p[0].v);
 }
 
+uint32_t get_key_hash(lisp_t *l, lisp_cell_t *x) {
+	assert(l && x && is_asciiz(x));
+	if (x->hashed)
+		return x->hash;
+	/*the built in symbols are static cells with no room for a length*/
+	size_t len = x->uncollectable ? strlen(get_str(x)) : get_length(x);
+	uint32_t h = hash_string(get_str(x), len, l->hash_seed);
+	if (!x->uncollectable) { /*built in symbols are shared by interpreters with different seeds*/
+		x->hash = h;
+		x->hashed = 1;
+	}
+	return h;
+}
+
+/**@brief mix the hash of a part of a key in to the hash so far*/
+static uint64_t hash_mix(uint64_t h, uint64_t part, uint64_t seed) {
+	uint64_t m[2] = { h, part };
+	return wyhash(m, sizeof(m), seed);
+}
+
+/**@brief hash any key by its identity*/
+static uint32_t hash_eq(const void *key, uint64_t seed) {
+	return wyhash(&key, sizeof(key), seed);
+}
+
+/**@brief hash numbers by their type and value, anything else by identity*/
+static uint32_t hash_eql(const void *key, uint64_t seed) {
+	lisp_cell_t *x = (lisp_cell_t*)key;
+	if (is_int(x)) {
+		intptr_t i = get_int(x);
+		return wyhash(&i, sizeof(i), seed);
+	}
+	if (is_floating(x)) {
+		lisp_float_t f = get_float(x);
+		return wyhash(&f, sizeof(f), ~seed);
+	}
+	return hash_eq(key, seed);
+}
+
+/**@brief how many conses are looked at when hashing keys with "equal", so
+ * keys that are long or circular are still done with*/
+#define HASH_EQUAL_CELLS (256)
+
+/**@brief hash strings by their text and conses by their contents, at
+ * most "*cells" conses are looked at*/
+static uint64_t hash_structure(lisp_cell_t *x, uint64_t seed, size_t *cells) {
+	if (is_str(x))
+		return hash_string(get_str(x), get_length(x), seed);
+	if (!is_cons(x))
+		return hash_eql(x, seed);
+	uint64_t h = seed;
+	for (; is_cons(x) && *cells; x = cdr(x)) {
+		(*cells)--;
+		h = hash_mix(h, hash_structure(car(x), seed, cells), seed);
+	}
+	return is_cons(x) ? h : hash_mix(h, hash_structure(x, seed, cells), seed);
+}
+
+static uint32_t hash_equal(const void *key, uint64_t seed) {
+	size_t cells = HASH_EQUAL_CELLS;
+	return hash_structure((lisp_cell_t*)key, seed, &cells);
+}
+
+static int compare_eq(const void *a, const void *b) {
+	return a != b;
+}
+
+static int compare_eql(const void *a, const void *b) {
+	lisp_cell_t *x = (lisp_cell_t*)a, *y = (lisp_cell_t*)b;
+	if (x == y)
+		return 0;
+	if (is_int(x) && is_int(y))
+		return get_int(x) != get_int(y);
+	if (is_floating(x) && is_floating(y)) {
+		lisp_float_t fx = get_float(x), fy = get_float(y);
+		return !!memcmp(&fx, &fy, sizeof(fx));
+	}
+	return 1;
+}
+
+/**@brief a pair of conses on the path "compare_structure" has taken, kept
+ * for Brent's cycle detection*/
+typedef struct {
+	lisp_cell_t *x, *y; /**< the pair last saved*/
+	size_t steps,       /**< pairs passed since it was saved*/
+	       limit;       /**< save the next pair after this many*/
+} compare_trail_t;
+
+/**@brief compare strings by their text and conses by their contents. Keys
+ * that loop would be walked forever, so pairs of conses met on the way
+ * down are checked against one saved further up; meeting it again means
+ * the keys repeat from there, and they are equal if nothing else on the
+ * way differs. The trail is passed by value so it always holds a pair
+ * still being compared.*/
+static int compare_structure(lisp_cell_t *x, lisp_cell_t *y, compare_trail_t t) {
+	for (; x != y && is_cons(x) && is_cons(y); x = cdr(x), y = cdr(y)) {
+		if (x == t.x && y == t.y)
+			return 0;
+		if (++t.steps == t.limit) {
+			t.x = x;
+			t.y = y;
+			t.steps = 0;
+			t.limit *= 2;
+		}
+		if (compare_structure(car(x), car(y), t))
+			return 1;
+	}
+	if (is_str(x) && is_str(y))
+		return get_length(x) != get_length(y) || memcmp(get_str(x), get_str(y), get_length(x));
+	return compare_eql(x, y);
+}
+
+static int compare_equal(const void *a, const void *b) {
+	compare_trail_t t = { NULL, NULL, 0, 1 };
+	return compare_structure((lisp_cell_t*)a, (lisp_cell_t*)b, t);
+}
+
+static void hash_no_free(void *p) {
+	UNUSED(p);
+}
+
+hash_table_t *hash_create_test(lisp_t *l, hash_test_e test, size_t len) {
+	assert(l);
+	hash_table_t *h = NULL;
+	switch (test) {
+	case HASH_STRING: return hash_create_seeded(len, l->hash_seed);
+	case HASH_EQ:    h = hash_create_custom_seeded(len, hash_no_free, hash_no_free, compare_eq,    hash_eq);    break;
+	case HASH_EQL:   h = hash_create_custom_seeded(len, hash_no_free, hash_no_free, compare_eql,   hash_eql);   break;
+	case HASH_EQUAL: h = hash_create_custom_seeded(len, hash_no_free, hash_no_free, compare_equal, hash_equal); break;
+	}
+	if (h)
+		h->seed = l->hash_seed;
+	return h;
+}
+
+hash_test_e get_hash_test(hash_table_t *h) {
+	assert(h);
+	if (h->hash == hash_eq)
+		return HASH_EQ;
+	if (h->hash == hash_eql)
+		return HASH_EQL;
+	if (h->hash == hash_equal)
+		return HASH_EQUAL;
+	return HASH_STRING;
+}
+
+lisp_cell_t *lisp_hash_lookup(lisp_t *l, hash_table_t *h, lisp_cell_t *key) {
+	assert(l && h && key);
+	if (get_hash_test(h) != HASH_STRING)
+		return hash_lookup(h, (char*)key);
+	if (!is_asciiz(key))
+		return NULL;
+	return hash_lookup_hashed(h, get_str(key), get_key_hash(l, key), l->hash_seed);
+}
+
+int lisp_hash_insert(lisp_t *l, hash_table_t *h, lisp_cell_t *key, lisp_cell_t *val) {
+	assert(l && h && key && val);
+	lisp_cell_t *pair = cons(l, key, val);
+	if (get_hash_test(h) != HASH_STRING)
+		return hash_insert(h, (char*)key, pair);
+	assert(is_asciiz(key));
+	return hash_insert_hashed(h, get_str(key), get_key_hash(l, key), l->hash_seed, pair);
+}
+
+int lisp_hash_remove(lisp_t *l, hash_table_t *h, lisp_cell_t *key) {
+	assert(l && h && key);
+	if (get_hash_test(h) != HASH_STRING)
+		return hash_remove(h, (char*)key);
+	if (!is_asciiz(key))
+		return -1;
+	return hash_remove_hashed(h, get_str(key), get_key_hash(l, key), l->hash_seed);
+}
+
+lisp_cell_t *get_frame_symbol(lisp_cell_t * x, size_t i) {
+	assert(x && is_frame(x) && i < get_frame_count(x));
+	lisp_cell_t *s = x->p[0].v;
+	for (; i && is_cons(s); i--)
+		s = cdr(s);
+	return is_cons(s) ? car(s) : s;
+}
+
+lisp_cell_t *get_frame_value(lisp_cell_t * x, size_t i) {
+	assert(x && is_frame(x) && i < get_frame_count(x));
+	return x->p[FRAME_HEADER + i].v;
+}
+
+size_t get_frame_count(lisp_cell_t * x) {
+	assert(x && is_frame(x));
+	return (uintptr_t)x->p[2].v;
+}
+
+lisp_cell_t *get_frame_parent(lisp_cell_t * x) {
+	assert(x && is_frame(x));
+	return x->p[1].v;
+}
+
 lisp_float_t get_float(lisp_cell_t * x) {
 	assert(x && is_floating(x));
 	return x->p[0].f;
@@ -391,18 +661,22 @@ lisp_cell_t *lisp_extend(lisp_t * l, lisp_cell_t * env, lisp_cell_t * sym, lisp_
 
 lisp_cell_t *lisp_intern(lisp_t * l, char *name) {
 	assert(l && name);
-	lisp_cell_t *op = hash_lookup(get_hash(l->all_symbols), name);
+	uint32_t hash = hash_string(name, strlen(name), l->hash_seed);
+	lisp_cell_t *op = hash_lookup_hashed(get_hash(l->all_symbols), name, hash, l->hash_seed);
 	if (op)
 		return op;
 	op = mk_sym(l, name);
-	hash_insert(get_hash(l->all_symbols), name, op);
+	op->hash = hash;
+	op->hashed = 1;
+	hash_insert_hashed(get_hash(l->all_symbols), name, hash, l->hash_seed, op);
+	lisp_gc_write_barrier(l->all_symbols);
 	return op;
 }
 
 /**@todo make use of lisp_copy to make closures work */
 lisp_cell_t *lisp_copy(lisp_t *l, lisp_cell_t *src) {
 	assert(l && src);
-	switch (src->type) {
+	switch (TYPE(src)) {
 	case SUBR:
 	case SYMBOL:
 		return src; /*symbols, subroutines must be immutable*/
@@ -423,14 +697,28 @@ lisp_cell_t *lisp_copy(lisp_t *l, lisp_cell_t *src) {
 	}
 	case FLOAT:
 		return mk_float(l, get_float(src));
+	case LEXICAL:
+	case CODE:
+		return src;
+	case FRAME:
+	{
+		lisp_cell_t *f = mk_cell(l, FRAME, FRAME_HEADER + get_frame_count(src));
+		f->p[0].v = src->p[0].v;
+		f->p[2].v = src->p[2].v;
+		for (size_t i = 0; i < get_frame_count(src); i++)
+			f->p[FRAME_HEADER + i].v = lisp_copy(l, get_frame_value(src, i));
+		f->p[1].v = lisp_copy(l, get_frame_parent(src));
+		return f;
+	}
 	case PROC:
 	case FPROC:
-		return mk(l, src->type, 5,
+		return mk(l, src->type, 6,
 				lisp_copy(l, get_proc_args(src)),
 				lisp_copy(l, get_proc_code(src)),
 				lisp_copy(l, get_proc_env(src)),
 				NULL,
-				get_func_docstring(src));
+				get_func_docstring(src),
+				get_proc_bytecode(src));
 	case IO:
 	case USERDEF:
 		LISP_RECOVER(l, "%y'cannot-copy%t\n %S", src);
@@ -445,40 +733,136 @@ lisp_cell_t *lisp_copy(lisp_t *l, lisp_cell_t *src) {
 
 /***************************** environment ************************************/
 
+/* An environment is a chain of frames and association lists, the top level
+ * ends with a hash of (symbol . value) pairs. Procedure calls bind their
+ * arguments in a single frame, "let" and "compile" still bind pairs. */
+
+lisp_cell_t *mk_frame(lisp_t *l, lisp_cell_t *syms, size_t count, lisp_cell_t *env) {
+	assert(l && syms && env && count && count <= GC_MAX_FIELDS - FRAME_HEADER);
+	lisp_cell_t *f = mk_cell(l, FRAME, FRAME_HEADER + count);
+	f->p[0].v = syms;
+	f->p[1].v = env;
+	f->p[2].v = (void *)count;
+	for (size_t i = 0; i < count; i++)
+		f->p[FRAME_HEADER + i].v = l->nil;
+	return f;
+}
+
+size_t frame_slots(lisp_cell_t *syms) {
+	size_t n = 0;
+	for (; is_cons(syms); syms = cdr(syms))
+		n++;
+	return is_nil(syms) ? n : n + 1;
+}
+
+lisp_cell_t *env_bind(lisp_t *l, lisp_cell_t *syms, lisp_cell_t *vals, lisp_cell_t *env) {
+	lisp_cell_t *s, *f;
+	size_t n = frame_slots(syms), i = 0;
+	if (!n)
+		return env;
+	if (n > GC_MAX_FIELDS - FRAME_HEADER) {
+		for (s = syms; is_cons(s) && is_cons(vals); s = cdr(s), vals = cdr(vals))
+			env = lisp_extend(l, env, car(s), car(vals));
+		if (is_cons(s))
+			return NULL;
+		return is_nil(s) ? env : lisp_extend(l, env, s, vals);
+	}
+	f = mk_frame(l, syms, n, env);
+	for (s = syms; is_cons(s) && is_cons(vals); s = cdr(s), vals = cdr(vals))
+		f->p[FRAME_HEADER + i++].v = car(vals);
+	if (is_cons(s))
+		return NULL;
+	if (!is_nil(s))
+		f->p[FRAME_HEADER + i].v = vals;
+	return f;
+}
+
+/**@brief find the slot a symbol is bound to in a frame, if a symbol is
+ * repeated in an argument list the last one wins as it would in an a-list
+ * @return int non-zero if found, with the field index in "*field"*/
+static int frame_slot(lisp_cell_t *frame, lisp_cell_t *sym, size_t *field) {
+	lisp_cell_t *s = frame->p[0].v;
+	size_t i = 0, n = get_frame_count(frame), found = 0;
+	for (; is_cons(s) && i < n; s = cdr(s), i++)
+		if (car(s) == sym)
+			found = FRAME_HEADER + i;
+	if (i < n && s == sym)
+		found = FRAME_HEADER + i;
+	if (!found)
+		return 0;
+	*field = found;
+	return 1;
+}
+
+/**@brief find the global binding of a symbol, from its value cell if it
+ * has one. The built in special symbols are shared between interpreters
+ * and have no cell, so they are looked up in the top level hash.
+ * @return lisp_cell_t* the (symbol . value) pair, or NULL if unbound*/
+static lisp_cell_t *global_cell(lisp_t *l, lisp_cell_t *sym) {
+	if (is_sym(sym) && !sym->uncollectable && sym->p[2].v)
+		return sym->p[2].v;
+	return hash_lookup_hashed(get_hash(l->top_hash), get_str(sym), get_key_hash(l, sym), l->hash_seed);
+}
+
+lisp_cell_t *env_lookup(lisp_t *l, lisp_cell_t *sym, lisp_cell_t *env, size_t *field) {
+	for (;;) {
+		if (is_frame(env)) {
+			if (frame_slot(env, sym, field))
+				return env;
+			env = get_frame_parent(env);
+		} else if (is_cons(env)) {
+			lisp_cell_t *b = car(env);
+			if (is_cons(b)) {
+				if (car(b) == sym) {
+					*field = 1;
+					return b;
+				}
+			} else if (is_hash(b)) {
+				b = b == l->top_hash && is_asciiz(sym) ? global_cell(l, sym) : lisp_hash_lookup(l, get_hash(b), sym);
+				if (b) {
+					*field = 1;
+					return b;
+				}
+			}
+			env = cdr(env);
+		} else {
+			return NULL;
+		}
+	}
+}
+
 static lisp_cell_t *function_args(lisp_t * l, lisp_cell_t *proc, lisp_cell_t * vals) {
 	assert(l && proc && vals);
 	lisp_cell_t *env = dynamic_on ? l->cur_env : get_proc_env(proc);
-       	lisp_cell_t *syms = get_proc_args(proc);
-	size_t i = 0, expect = get_length(get_proc_args(proc));
-	if (!expect)
-		return env;
-	const size_t test = is_sym(syms) ? 0 : 1;
-	for (i = 0; is_cons(syms) && is_cons(vals); syms = cdr(syms), vals = cdr(vals), i++)
-		env = lisp_extend(l, env, car(syms), car(vals));
-	if (!is_nil(syms))
-		env = lisp_extend(l, env, syms, vals);
-	if (test && expect != i)
+	if (!(env = env_bind(l, get_proc_args(proc), vals, env)))
 		LISP_RECOVER(l, "%y'argument-count-error%t\n %S\n '%S", proc, vals);
 	return env;
 }
 
 lisp_cell_t *lisp_extend_top(lisp_t * l, lisp_cell_t * sym, lisp_cell_t * val) {
 	assert(l && sym && val);
-	if (hash_insert(get_hash(l->top_hash), get_str(sym), cons(l, sym, val)) < 0)
+	lisp_cell_t *pair = cons(l, sym, val);
+	if (hash_insert_hashed(get_hash(l->top_hash), get_str(sym), get_key_hash(l, sym), l->hash_seed, pair) < 0)
 		lisp_out_of_memory(l);
+	l->binding_version++;
+	lisp_gc_write_barrier(l->top_hash);
+	if (is_sym(sym) && !sym->uncollectable) {
+		sym->p[2].v = pair;
+		lisp_gc_write_barrier(sym);
+	}
 	return val;
 }
 
 /**@todo an rassoc, that would search for a value and return a key, would be
  *       very useful*/
-lisp_cell_t *lisp_assoc(lisp_cell_t * key, lisp_cell_t * alist) {
-	assert(key && alist);
+lisp_cell_t *lisp_assoc(lisp_t *l, lisp_cell_t * key, lisp_cell_t * alist) {
+	assert(l && key && alist);
 	for (; is_cons(alist); alist = cdr(alist))
 		if (is_cons(car(alist))) {	/*normal assoc */
 			if (get_int(CAAR(alist)) == get_int(key))
 				return car(alist);
-		} else if (is_hash(car(alist)) && is_asciiz(key)) {	/*assoc extended with hashes */
-			lisp_cell_t *lookup = hash_lookup(get_hash(car(alist)), get_str(key));
+		} else if (is_hash(car(alist))) {	/*assoc extended with hashes */
+			lisp_cell_t *lookup = lisp_hash_lookup(l, get_hash(car(alist)), key);
 			if (lookup)
 				return lookup;
 		}
@@ -489,36 +873,488 @@ lisp_cell_t *lisp_assoc(lisp_cell_t * key, lisp_cell_t * alist) {
 
 /******************************** evaluator ***********************************/
 
-/** @brief "Compile" an expression, that is, perform optimizations
- *         and bind as many variables as possible. This function
- *         is a work in progress.
- *  @bug  This function really, really needs fixing.
- *  @bug  F-Expressions should be prevent compilation of their arguments
- *  @todo Add warning about unbound variables
+/** @brief "Compile" an expression. The body of a procedure made with
+ *         "compile" is walked once when it is made and optimized:
+ *
+ *         - Variables bound at that time, other than the arguments and
+ *           variables bound within the body, are replaced by their
+ *           values, quoted if they do not evaluate to themselves.
+ *           Unbound variables are left as symbols and noted in the log.
+ *         - Calls to pure primitives (see PURE_XLIST in subr.c) with
+ *           constant numeric arguments are folded into their result.
+ *         - An "if" or "cond" with a constant test loses the branches
+ *           that cannot be taken.
+ *         - Calls to small procedures made by "compile" are inlined,
+ *           provided doing so does not change when or whether the
+ *           arguments are evaluated.
+ *
+ *         Quoted data is left alone, as are the arguments of calls to
+ *         F-expressions, the operator of a late bound call such as
+ *         "('f x)", and nested "compile" forms which are optimized when
+ *         they are evaluated.
  **/
-static lisp_cell_t *binding_lambda(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * env) {
+#define INLINE_MAX_NODES (24) /**< largest body "compile" will inline*/
+#define INLINE_MAX_ARGS  (8)  /**< most arguments an inlined procedure can have*/
+#define INLINE_MAX_DEPTH (4)  /**< most inlined calls nested within each other*/
+
+static int is_special_form(lisp_cell_t *x);
+
+/**@brief what an inlined procedure does with its arguments*/
+typedef struct {
+	lisp_cell_t *params[INLINE_MAX_ARGS];
+	unsigned uses[INLINE_MAX_ARGS],  /**< times an argument is used*/
+		 order[INLINE_MAX_ARGS], /**< when it was first evaluated*/
+		 lazy[INLINE_MAX_ARGS],  /**< is it possibly not evaluated?*/
+		 late[INLINE_MAX_ARGS];  /**< was a call made before it?*/
+	unsigned count, nodes, seen;
+	int called;
+} inline_scan_t;
+
+static int is_constant(lisp_t *l, lisp_cell_t *x) {
+	if (is_cons(x))
+		return car(x) == l->quote && is_cons(cdr(x));
+	if (is_sym(x))
+		return x == l->nil || x == l->tee;
+	return TYPE(x) != LEXICAL;
+}
+
+static lisp_cell_t *constant_value(lisp_cell_t *x) {
+	return is_cons(x) ? CADR(x) : x;
+}
+
+static lisp_cell_t *quoted(lisp_t *l, lisp_cell_t *x) {
+	if (is_cons(x) || (is_sym(x) && x != l->nil && x != l->tee))
+		return cons(l, l->quote, cons(l, x, l->nil));
+	return x;
+}
+
+static lisp_cell_t *compile_bind(lisp_t *l, lisp_cell_t *args, lisp_cell_t *env) {
+	for (; is_cons(args); args = cdr(args))
+		if (is_sym(car(args)))
+			env = lisp_extend(l, env, car(args), car(args));
+	if (is_sym(args) && !is_nil(args))
+		env = lisp_extend(l, env, args, args);
+	return env;
+}
+
+/**@brief fold a call to a pure primitive if its arguments are all constant
+ * numbers of the types it expects, this is checked here as the validation
+ * functions report failures
+ * @return lisp_cell_t* the result or NULL if it cannot be folded*/
+static lisp_cell_t *fold(lisp_t *l, lisp_cell_t *proc, lisp_cell_t *args) {
+	lisp_cell_t *vals = cons(l, l->nil, l->nil), *last = vals, *x;
+	char *fmt;
+	size_t n = 0;
+	if (!is_subr(proc) || !proc->pure)
+		return NULL;
+	fmt = get_func_format(proc);
+	for (; is_cons(args); args = cdr(args), n++) {
+		if (!is_constant(l, car(args)) || !is_arith(x = constant_value(car(args))))
+			return NULL;
+		if (fmt) {
+			while (*fmt == ' ')
+				fmt++;
+			if (!*fmt || (*fmt == 'd' && !is_int(x)) || (*fmt != 'd' && *fmt != 'a' && *fmt != 'A'))
+				return NULL;
+			fmt++;
+		}
+		set_cdr(last, cons(l, x, l->nil));
+		last = cdr(last);
+	}
+	if (fmt ? n != get_length(proc) : n < 1)
+		return NULL;
+	return quoted(l, lisp_subr_call(l, proc, cdr(vals)));
+}
+
+static int inline_scan(lisp_t *l, inline_scan_t *s, lisp_cell_t *x, int strict) {
+	unsigned i;
+	if (++s->nodes > INLINE_MAX_NODES)
+		return 0;
+	if (is_sym(x)) {
+		if (x == l->nil || x == l->tee)
+			return 1;
+		for (i = 0; i < s->count && s->params[i] != x; i++)
+			;
+		if (i == s->count)
+			return 0; /* free variables belong to the environment of the procedure */
+		if (!s->uses[i]++) {
+			s->order[i] = s->seen++;
+			s->late[i] = s->called;
+		}
+		s->lazy[i] |= !strict;
+		return 1;
+	}
+	if (!is_cons(x))
+		return TYPE(x) != LEXICAL;
+	if (!is_proper_cons(x))
+		return 0;
+	if (car(x) == l->quote)
+		return 1;
+	if (car(x) == l->iif) {
+		if (!lisp_check_length(x, 4) || !inline_scan(l, s, CADR(x), strict))
+			return 0;
+		s->called = 1;
+		return inline_scan(l, s, CADDR(x), 0) && inline_scan(l, s, CADDDR(x), 0);
+	}
+	if (car(x) == l->cond) {
+		for (x = cdr(x), i = 0; is_cons(x); x = cdr(x), i++) {
+			if (!is_cons(car(x)) || !lisp_check_length(car(x), 2))
+				return 0;
+			if (!inline_scan(l, s, CAAR(x), strict && !i))
+				return 0;
+			s->called = 1;
+			if (!inline_scan(l, s, CADAR(x), 0))
+				return 0;
+		}
+		return 1;
+	}
+	if (is_special_form(car(x)) || is_fproc(car(x)) || is_cons(car(x)))
+		return 0;
+	for (; is_cons(x); x = cdr(x))
+		if (!inline_scan(l, s, car(x), strict))
+			return 0;
+	s->called = 1;
+	return 1;
+}
+
+static lisp_cell_t *inline_subst(lisp_t *l, inline_scan_t *s, lisp_cell_t *x, lisp_cell_t *args) {
+	lisp_cell_t *head, *last;
+	unsigned i;
+	if (is_sym(x)) {
+		for (i = 0; i < s->count; i++, args = cdr(args))
+			if (s->params[i] == x)
+				return car(args);
+		return x;
+	}
+	if (!is_cons(x) || car(x) == l->quote)
+		return x;
+	head = last = cons(l, l->nil, l->nil);
+	for (; is_cons(x); x = cdr(x), last = cdr(last))
+		set_cdr(last, cons(l, inline_subst(l, s, car(x), args), l->nil));
+	return cdr(head);
+}
+
+static lisp_cell_t *binding_lambda(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * env, unsigned inlining);
+
+/**@brief inline a call to a procedure made by "compile"
+ * @return lisp_cell_t* the optimized body or NULL if it cannot be inlined*/
+static lisp_cell_t *inline_call(lisp_t *l, unsigned depth, lisp_cell_t *proc, lisp_cell_t *args, lisp_cell_t *env, unsigned inlining) {
+	inline_scan_t s = { .count = 0 };
+	lisp_cell_t *p, *code;
+	unsigned i, j, order = 0;
+	if (dynamic_on || !is_proc(proc) || !proc->compiled || inlining >= INLINE_MAX_DEPTH)
+		return NULL;
+	code = get_proc_code(proc);
+	if (!is_cons(code) || !is_nil(cdr(code)))
+		return NULL;
+	for (p = get_proc_args(proc); is_cons(p) && s.count < INLINE_MAX_ARGS; p = cdr(p)) {
+		if (!is_sym(car(p)) || is_nil(car(p)))
+			return NULL;
+		for (j = 0; j < s.count; j++)
+			if (s.params[j] == car(p))
+				return NULL;
+		s.params[s.count++] = car(p);
+	}
+	if (!is_nil(p) || !lisp_check_length(args, s.count))
+		return NULL;
+	if (!inline_scan(l, &s, car(code), 1))
+		return NULL;
+	for (i = 0, p = args; i < s.count; i++, p = cdr(p)) {
+		if (is_constant(l, car(p)) || is_sym(car(p)))
+			continue;
+		/* an expression is substituted once, in the order it would
+		 * have been evaluated, before anything else is called */
+		if (s.uses[i] != 1 || s.lazy[i] || s.late[i] || s.order[i] < order)
+			return NULL;
+		order = s.order[i];
+	}
+	return binding_lambda(l, depth + 1, inline_subst(l, &s, car(code), args), env, inlining + 1);
+}
+
+static lisp_cell_t *binding_list(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * env, unsigned inlining) {
+	lisp_cell_t *head = cons(l, l->nil, l->nil), *op = head;
+	for (; is_cons(exp); exp = cdr(exp), op = cdr(op))
+		set_cdr(op, cons(l, binding_lambda(l, depth + 1, car(exp), env, inlining), l->nil));
+	if (!is_nil(exp))
+		LISP_RECOVER(l, "%r\"compile cannot eval dotted pairs\"%t\n '%S", cdr(head));
+	return cdr(head);
+}
+
+static lisp_cell_t *binding_cond(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * env, unsigned inlining) {
+	lisp_cell_t *head = cons(l, l->cond, l->nil), *op = head, *test, *x;
+	for (x = cdr(exp); is_cons(x); x = cdr(x))
+		if (!is_cons(car(x)) || !lisp_check_length(car(x), 2))
+			return exp;
+	for (x = cdr(exp); is_cons(x); x = cdr(x)) {
+		test = binding_lambda(l, depth + 1, CAAR(x), env, inlining);
+		if (is_constant(l, test) && is_nil(constant_value(test)))
+			continue;
+		if (is_constant(l, test) && op == head)
+			return binding_lambda(l, depth + 1, CADAR(x), env, inlining);
+		set_cdr(op, cons(l, mk_list(l, test, binding_lambda(l, depth + 1, CADAR(x), env, inlining), NULL), l->nil));
+		op = cdr(op);
+		if (is_constant(l, test))
+			break;
+	}
+	return op == head ? l->nil : head;
+}
+
+static lisp_cell_t *binding_let(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * env, unsigned inlining) {
+	lisp_cell_t *head = cons(l, l->let, l->nil), *op = head, *x;
+	for (x = cdr(exp); is_cons(x) && is_cons(cdr(x)); x = cdr(x))
+		if (!is_cons(car(x)) || !lisp_check_length(car(x), 2) || !is_sym(CAAR(x)))
+			return exp;
+	for (x = cdr(exp); is_cons(x) && is_cons(cdr(x)); x = cdr(x), op = cdr(op)) {
+		env = lisp_extend(l, env, CAAR(x), CAAR(x));
+		set_cdr(op, cons(l, mk_list(l, CAAR(x), binding_lambda(l, depth + 1, CADAR(x), env, inlining), NULL), l->nil));
+	}
+	set_cdr(op, binding_list(l, depth, x, env, inlining));
+	return head;
+}
+
+static lisp_cell_t *binding_lambda(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * env, unsigned inlining) {
+	lisp_cell_t *first, *args, *t;
+	size_t f;
 	if (depth > MAX_RECURSION_DEPTH)
 		LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", depth);
-
 	if (is_sym(exp)) {
-		lisp_cell_t *t = lisp_assoc(exp, env);
-		return !is_nil(t) ? cdr(t) : exp;
+		if ((t = env_lookup(l, exp, env, &f)))
+			return CELL_FIELDS(t)[f].v == exp ? exp : quoted(l, CELL_FIELDS(t)[f].v);
+		if (!inlining)
+			lisp_log_note(l, "%y'compile %r\"unbound variable\"%t '%s", get_sym(exp));
+		return exp;
 	}
-	lisp_cell_t *op = cons(l, l->nil, l->nil);
-	lisp_cell_t *head = op;
-	for (; is_cons(exp); exp = cdr(exp), op = cdr(op)) {
-		lisp_cell_t *code = car(exp), *t = NULL;
-		if (is_sym(car(exp)) && !is_nil(t = lisp_assoc(car(exp), env)))
-			code = cdr(t);
-		else if (is_cons(car(exp)) && (CAAR(exp) != l->quote))
-			code = binding_lambda(l, depth + 1, car(exp), env);
+	if (!is_cons(exp))
+		return exp;
+	first = car(exp);
+	if (first == l->quote || first == l->compile || first == l->macro)
+		return exp;
+	if (is_sym(first) && first->form >= FORM_USER)
+		return exp;
+	if (first == l->iif) {
+		if (!lisp_check_length(exp, 4))
+			return binding_list(l, depth, exp, env, inlining);
+		t = binding_lambda(l, depth + 1, CADR(exp), env, inlining);
+		if (is_constant(l, t))
+			return binding_lambda(l, depth + 1, is_nil(constant_value(t)) ? CADDDR(exp) : CADDR(exp), env, inlining);
+		return cons(l, first, cons(l, t, binding_list(l, depth, CDDR(exp), env, inlining)));
+	}
+	if (first == l->cond)
+		return binding_cond(l, depth, exp, env, inlining);
+	if (first == l->let)
+		return binding_let(l, depth, exp, env, inlining);
+	if (first == l->lambda || first == l->flambda) {
+		lisp_cell_t *head = cons(l, first, l->nil), *op = head;
+		args = cdr(exp);
+		if (is_cons(args) && is_str(car(args))) { /* doc string */
+			set_cdr(op, cons(l, car(args), l->nil));
+			op = cdr(op);
+			args = cdr(args);
+		}
+		if (!is_cons(args))
+			return exp;
+		env = compile_bind(l, car(args), env);
+		set_cdr(op, cons(l, car(args), binding_list(l, depth, cdr(args), env, inlining)));
+		return head;
+	}
+	if (first == l->define || first == l->setq) {
+		if (!is_cons(cdr(exp)))
+			return exp;
+		return cons(l, first, cons(l, CADR(exp), binding_list(l, depth, CDDR(exp), env, inlining)));
+	}
+	if (first == l->progn || first == l->dowhile)
+		return cons(l, first, binding_list(l, depth, cdr(exp), env, inlining));
+	if (is_cons(first) && car(first) == l->quote) /* late bound, see eval() */
+		return cons(l, first, binding_list(l, depth, cdr(exp), env, inlining));
+	first = binding_lambda(l, depth + 1, first, env, inlining);
+	if (is_fproc(first))
+		return cons(l, first, cdr(exp));
+	args = binding_list(l, depth, cdr(exp), env, inlining);
+	if ((t = fold(l, first, args)) || (t = inline_call(l, depth, first, args, env, inlining)))
+		return t;
+	return cons(l, first, args);
+}
+
+/** @brief Lexical addressing. When a lambda is made its body is walked
+ *         once and every reference to a variable bound by a lambda or a
+ *         let is replaced by the position of its binding within the
+ *         environment the body will be evaluated in; the number of frames
+ *         and pairs to skip and the slot within the frame. The environment
+ *         is built in the same way each time so the position does not
+ *         change. The body is resolved in a copy, the list it was made
+ *         from may be quoted or shared with other code and is left as it
+ *         was. Nested lambdas are resolved in the same pass and marked
+ *         so they are not walked again. Global and unbound variables are
+ *         left as symbols, as is anything quoted, the bodies of "compile"
+ *         and the arguments to F-expressions, which expect symbols.
+ *
+ *         The address is only ever used as a hint, the symbol is kept
+ *         and checked against the binding found, if the code is
+ *         evaluated in another environment (by "eval" for example) the
+ *         symbol is looked up as normal.
+ **/
+static int is_special_form(lisp_cell_t *x) {
+	return is_sym(x) && x->form != FORM_NONE;
+}
+
+/**@brief the lexical address of a symbol in a scope, or the symbol itself
+ * if it is not bound within a lambda or let. The address of a variable in
+ * a frame records the argument list the frame was made for, which is
+ * checked instead of the symbol.*/
+static lisp_cell_t *lexical_address(lisp_t *l, lisp_cell_t *sym, lisp_cell_t *scope) {
+	uintptr_t d = 0;
+	size_t f;
+	if (is_special_form(sym))
+		return sym;
+	for (; scope != l->top_env; d++) {
+		if (is_frame(scope)) {
+			if (frame_slot(scope, sym, &f))
+				return mk(l, LEXICAL, 4, sym, (void *)d, (void *)(f - FRAME_HEADER), scope->p[0].v);
+			scope = get_frame_parent(scope);
+		} else if (is_cons(scope) && is_cons(car(scope))) {
+			if (CAAR(scope) == sym)
+				return mk(l, LEXICAL, 4, sym, (void *)d, (void *)0, NULL);
+			scope = cdr(scope);
+		} else {
+			break;
+		}
+	}
+	return sym;
+}
+
+/**@brief find the binding a lexical address refers to, falling back to a
+ * normal lookup if the environment is not the shape it was resolved in
+ * @return lisp_cell_t* the frame or pair holding the value in field
+ *         "*field", or NULL if it is unbound*/
+static lisp_cell_t *lexical_binding(lisp_t *l, lisp_cell_t *x, lisp_cell_t *env, size_t *field) {
+	lisp_cell_t *e = env, *layout = x->p[3].v;
+	uintptr_t index = (uintptr_t)x->p[2].v;
+	for (uintptr_t d = (uintptr_t)x->p[1].v; d; d--)
+		if (is_frame(e))
+			e = get_frame_parent(e);
+		else if (is_cons(e))
+			e = cdr(e);
 		else
-			code = car(exp);
-		set_cdr(op, cons(l, code, l->nil));
+			break;
+	if (layout) {
+		if (is_frame(e) && e->p[0].v == layout && index < get_frame_count(e)) {
+			*field = FRAME_HEADER + index;
+			return e;
+		}
+	} else if (is_cons(e) && is_cons(car(e)) && CAAR(e) == x->p[0].v) {
+		*field = 1;
+		return car(e);
 	}
-	if (!is_nil(exp))
-		LISP_RECOVER(l, "%r\"compile cannot eval dotted pairs\"%t\n '%S", head);
-	return cdr(head);
+	return env_lookup(l, x->p[0].v, env, field);
+}
+
+static lisp_cell_t *lexical_resolve(lisp_t *l, unsigned depth, lisp_cell_t *exp, lisp_cell_t *scope);
+
+static void lexical_resolve_list(lisp_t *l, unsigned depth, lisp_cell_t *exps, lisp_cell_t *scope) {
+	for (; is_cons(exps); exps = cdr(exps)) {
+		lisp_cell_t *x = lexical_resolve(l, depth, car(exps), scope);
+		if (x != car(exps))
+			set_car(exps, x);
+	}
+}
+
+/**@brief resolve the body of a lambda or F-expression, the arguments are
+ * bound in the same way as function_args() binds them*/
+static void lexical_resolve_lambda(lisp_t *l, unsigned depth, lisp_cell_t *args, lisp_cell_t *body, lisp_cell_t *scope) {
+	if (dynamic_on || !is_cons(body) || lisp_gc_resolved(body))
+		return;
+	lexical_resolve_list(l, depth, body, env_bind(l, args, args, scope));
+	lisp_gc_set_resolved(body);
+}
+
+/**@brief copy the list structure of code so that it can be resolved in
+ * place, anything quoted is shared with the original*/
+static lisp_cell_t *lexical_copy(lisp_t *l, unsigned depth, lisp_cell_t *exp) {
+	lisp_cell_t *head, *tail;
+	if (depth > MAX_RECURSION_DEPTH)
+		LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", depth);
+	if (!is_cons(exp) || car(exp) == l->quote)
+		return exp;
+	head = tail = cons(l, lexical_copy(l, depth + 1, car(exp)), l->nil);
+	for (exp = cdr(exp); is_cons(exp); exp = cdr(exp), tail = cdr(tail))
+		set_cdr(tail, cons(l, lexical_copy(l, depth + 1, car(exp)), l->nil));
+	set_cdr(tail, exp);
+	return head;
+}
+
+/**@brief resolve the body of a lambda or F-expression that is being made
+ * @return lisp_cell_t* the body to make it with, a resolved copy*/
+static lisp_cell_t *lexical_resolve_body(lisp_t *l, unsigned depth, lisp_cell_t *args, lisp_cell_t *body, lisp_cell_t *scope) {
+	if (dynamic_on || !is_cons(body) || lisp_gc_resolved(body))
+		return body;
+	body = lexical_copy(l, depth, body);
+	lexical_resolve_lambda(l, depth, args, body, scope);
+	return body;
+}
+
+static lisp_cell_t *lexical_resolve(lisp_t *l, unsigned depth, lisp_cell_t *exp, lisp_cell_t *scope) {
+	lisp_cell_t *first, *x, *b;
+	size_t f;
+	if (depth > MAX_RECURSION_DEPTH)
+		LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", depth);
+	if (is_sym(exp))
+		return lexical_address(l, exp, scope);
+	if (!is_cons(exp))
+		return exp;
+	first = car(exp);
+	x = cdr(exp);
+	if (first == l->quote || first == l->compile || !is_cons(x))
+		return exp;
+	if (is_sym(first) && first->form >= FORM_USER)
+		return exp; /* forms added by modules get their arguments as data */
+	if (first == l->lambda || first == l->flambda) {
+		if (is_str(car(x)) && is_cons(cdr(x)))
+			x = cdr(x);
+		lexical_resolve_lambda(l, depth + 1, car(x), cdr(x), scope);
+		return exp;
+	}
+	if (first == l->define) {
+		lexical_resolve_list(l, depth + 1, cdr(x), scope);
+		return exp;
+	}
+	if (first == l->setq) {
+		lexical_resolve_list(l, depth + 1, x, scope);
+		return exp;
+	}
+	if (first == l->cond) {
+		for (; is_cons(x); x = cdr(x))
+			lexical_resolve_list(l, depth + 1, car(x), scope);
+		return exp;
+	}
+	if (first == l->let) { /* each binding is added twice, see eval() */
+		for (; is_cons(cdr(x)); x = cdr(x)) {
+			b = car(x);
+			if (!is_cons(b) || !is_cons(cdr(b)))
+				return exp;
+			scope = lisp_extend(l, scope, car(b), car(b));
+			lexical_resolve_list(l, depth + 1, cdr(b), scope);
+			scope = lisp_extend(l, scope, car(b), car(b));
+		}
+		lexical_resolve_list(l, depth + 1, x, scope);
+		return exp;
+	}
+	if (is_sym(first) && (b = env_lookup(l, first, scope, &f)) && is_fproc(CELL_FIELDS(b)[f].v))
+		return exp; /* F-expressions get their arguments as data */
+	lexical_resolve_list(l, depth + 1, exp, scope);
+	return exp;
+}
+
+/**@brief the value of a variable, a symbol or a lexical address*/
+static lisp_cell_t *variable(lisp_t *l, lisp_cell_t *x, lisp_cell_t *env) {
+	lisp_cell_t *b;
+	size_t field;
+	if (TYPE(x) == LEXICAL) {
+		if (!(b = lexical_binding(l, x, env, &field)))
+			LISP_RECOVER(l, "%r\"unbound symbol\"\n %y'%s%t", get_sym(x->p[0].v));
+	} else if (!(b = env_lookup(l, x, env, &field))) {
+		LISP_RECOVER(l, "%r\"unbound symbol\"\n %y'%s%t", get_sym(x));
+	}
+	return CELL_FIELDS(b)[field].v;
 }
 
 static lisp_cell_t *evlis(lisp_t * l, unsigned depth, lisp_cell_t * exps, lisp_cell_t * env);
@@ -526,16 +1362,21 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 	assert(l);
 	size_t gc_stack_save = l->gc_stack_used;
 	lisp_cell_t *tmp, *first, *proc, *ret = NULL, *vals = l->nil;
+	size_t field;
 #define DEBUG_RETURN(EXPR) do { ret = (EXPR); goto debug; } while (0);
+/* Only the expression and the environment it is evaluated in need to be
+ * kept alive when going around again, so that a loop of tail calls runs
+ * in constant space */
+#define TAIL_ROOTS() do { l->gc_stack_used = gc_stack_save;\
+		lisp_gc_add(l, exp); lisp_gc_add(l, env); } while (0)
 	if (!exp || !env)
 		return NULL;
 	if (depth > MAX_RECURSION_DEPTH)
 		LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", 0);
-	lisp_gc_add(l, exp);
-	lisp_gc_add(l, env);
  tail:
 	if (!exp || !env)
 		return NULL;
+	TAIL_ROOTS();
 	lisp_log_debug(l, "%y'eval%t '%S", exp);
 	if (is_nil(exp))
 		return exp;
@@ -545,7 +1386,7 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 		lisp_throw(l, 1);
 	}
 
-	switch (exp->type) {
+	switch (TYPE(exp)) {
 	case INTEGER:
 	case SUBR:
 	case PROC:
@@ -555,13 +1396,12 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 	case HASH:
 	case FPROC:
 	case USERDEF:
+	case FRAME:
+	case CODE:
 		return exp;	/*self evaluating types */
 	case SYMBOL:
-		/* checks could be added here so special forms are not looked
-		 * up, but only if this improves the speed of things*/
-		if (is_nil(tmp = lisp_assoc(exp, env)))
-			LISP_RECOVER(l, "%r\"unbound symbol\"\n %y'%s%t", get_sym(exp));
-		DEBUG_RETURN(cdr(tmp));
+	case LEXICAL:
+		DEBUG_RETURN(variable(l, exp, env));
 	case CONS:
 		first = car(exp);
 		exp = cdr(exp);
@@ -581,12 +1421,14 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 			LISP_RECOVER(l, "%y'evaluation\n %r\"cannot eval dotted pair\"%t\n '%S", exp);
 		if (is_cons(first))
 			first = eval(l, depth + 1, first, env);
-		if (first == l->iif) {
+		switch (is_sym(first) ? first->form : FORM_NONE) {
+		case FORM_NONE:
+			break;
+		case FORM_IF:
 			LISP_VALIDATE_ARGS(l, "if", 3, "A A A", exp, 1);
 			exp = !is_nil(eval(l, depth + 1, car(exp), env)) ? CADR(exp) : CADDR(exp);
 			goto tail;
-		}
-		if (first == l->lambda) {
+		case FORM_LAMBDA: {
 			lisp_cell_t *doc;
 			if (get_length(exp) < 2)
 				LISP_RECOVER(l, "%y'lambda\n %r\"argc < 2\"%t\n '%S\"", exp);
@@ -596,19 +1438,24 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 			} else {
 				doc = l->empty_docstr;
 			}
+			tmp = lexical_resolve_body(l, depth + 1, car(exp), cdr(exp), env);
 			l->gc_stack_used = gc_stack_save;
-			tmp = mk_proc(l, car(exp), cdr(exp), env, doc);
-			DEBUG_RETURN(lisp_gc_add(l, tmp));
+			lisp_gc_add(l, tmp);
+			tmp = lisp_gc_add(l, mk_proc(l, car(exp), tmp, env, doc));
+			if (l->vm_on && !dynamic_on)
+				vm_compile(l, tmp);
+			DEBUG_RETURN(tmp);
 		}
-		if (first == l->flambda) {
+		case FORM_FLAMBDA:
 			if (get_length(exp) < 3 || !is_str(car(exp)) || !is_cons(CADR(exp)))
 				LISP_RECOVER(l, "%y'flambda\n %r\"expected (string (arg) code...)\"%t\n '%S", exp);
 			if (!lisp_check_length(CADR(exp), 1) || !is_sym(car(CADR(exp))))
 				LISP_RECOVER(l, "%y'flambda\n %r\"only one symbol argument allowed\"%t\n '%S", exp);
+			tmp = lexical_resolve_body(l, depth + 1, CADR(exp), CDDR(exp), env);
 			l->gc_stack_used = gc_stack_save;
-			DEBUG_RETURN(lisp_gc_add(l, mk_fproc(l, CADR(exp), CDDR(exp), env, car(exp))));
-		}
-		if (first == l->cond) {
+			lisp_gc_add(l, tmp);
+			DEBUG_RETURN(lisp_gc_add(l, mk_fproc(l, CADR(exp), tmp, env, car(exp))));
+		case FORM_COND:
 			if (lisp_check_length(exp, 0))
 				DEBUG_RETURN(l->nil);
 			for (tmp = l->nil; is_nil(tmp) && !is_nil(exp); exp = cdr(exp)) {
@@ -621,24 +1468,29 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 				}
 			}
 			DEBUG_RETURN(l->nil);
-		}
-		if (first == l->quote)
+		case FORM_QUOTE:
 			DEBUG_RETURN(car(exp));
-		if (first == l->define) {
+		case FORM_DEFINE:
 			LISP_VALIDATE_ARGS(l, "define", 2, "s A", exp, 1);
 			l->gc_stack_used = gc_stack_save;
 			DEBUG_RETURN(lisp_gc_add(l, lisp_extend_top(l, car(exp), eval(l, depth + 1, CADR(exp), env))));
-		}
-		if (first == l->setq) {
-			lisp_cell_t *pair, *newval;
-			LISP_VALIDATE_ARGS(l, "setq", 2, "s A", exp, 1);
-			if (is_nil(pair = lisp_assoc(car(exp), env)))
+		case FORM_SETQ: {
+			lisp_cell_t *newval;
+			if (is_cons(exp) && TYPE(car(exp)) == LEXICAL) {
+				LISP_VALIDATE_ARGS(l, "setq", 2, "A A", exp, 1);
+				tmp = lexical_binding(l, car(exp), env, &field);
+			} else {
+				LISP_VALIDATE_ARGS(l, "setq", 2, "s A", exp, 1);
+				tmp = env_lookup(l, car(exp), env, &field);
+			}
+			if (!tmp)
 				LISP_RECOVER(l, "%y'setq\n %r\"undefined variable\"%t\n '%S", exp);
 			newval = eval(l, depth + 1, CADR(exp), env);
-			set_cdr(pair, newval);
+			CELL_FIELDS(tmp)[field].v = newval;
+			lisp_gc_write_barrier(tmp);
 			DEBUG_RETURN(newval);
 		}
-		if (first == l->compile) {
+		case FORM_COMPILE: {
 			lisp_cell_t *doc;
 			LISP_VALIDATE_ARGS(l, "compile", 3, "Z L A", exp, 1);
 			doc = car(exp);
@@ -647,10 +1499,14 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 					LISP_RECOVER(l, "%y'lambda\n %r\"expected only symbols (or nil) as arguments\"%t\n %S", exp);
 				else
 					env = lisp_extend(l, env, car(tmp), car(tmp));
-			tmp = binding_lambda(l, depth + 1, CADDR(exp), env);
-			DEBUG_RETURN(mk_proc(l, CADR(exp), cons(l, tmp, l->nil), env, doc));
+			tmp = binding_lambda(l, depth + 1, CADDR(exp), env, 0);
+			tmp = mk_proc(l, CADR(exp), cons(l, tmp, l->nil), env, doc);
+			tmp->compiled = 1;
+			if (l->vm_on && !dynamic_on)
+				vm_compile(l, tmp);
+			DEBUG_RETURN(tmp);
 		}
-		if (first == l->let) {
+		case FORM_LET: {
 			lisp_cell_t *r = NULL, *s = NULL;
 			if (get_length(exp) < 2)
 				LISP_RECOVER(l, "%y'let\n %r\"argc < 2\"%t\n '%S", exp);
@@ -662,21 +1518,12 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 				r = env = lisp_extend(l, env, CAAR(exp), eval(l, depth + 1, CADAR(exp), env));
 				set_cdr(car(s), CDAR(r));
 			}
-			DEBUG_RETURN(eval(l, depth + 1, car(exp), env));
-		}
-		if (first == l->progn) {
-			lisp_cell_t *head = exp;
-			if (is_nil(exp))
-				DEBUG_RETURN(l->nil);
-			for (exp = head; !is_nil(cdr(exp)); exp = cdr(exp)) {
-				l->gc_stack_used = gc_stack_save;
-				(void)eval(l, depth + 1, car(exp), env);
-			}
 			exp = car(exp);
 			goto tail;
 		}
-
-		if (first == l->dowhile) {
+		case FORM_PROGN:
+			goto body;
+		case FORM_WHILE: {
 			lisp_cell_t *wh = car(exp), *head = cdr(exp);
 			while (!is_nil(eval(l, depth + 1, wh, env))) {
 				l->gc_stack_used = gc_stack_save;
@@ -687,12 +1534,37 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 			}
 			DEBUG_RETURN(l->nil);
 		}
-
-		if (first == l->macro) {
+		case FORM_MACRO:
 			/**@todo implement me*/
+			break;
+		default: /* added by a module */
+			l->gc_stack_used = gc_stack_save;
+			DEBUG_RETURN(l->forms[first->form](l, depth + 1, exp, env));
 		}
 
-		proc = eval(l, depth + 1, first, env);
+		/* the operator is looked up here, rather than by calling eval() */
+		if (is_sym(first) || TYPE(first) == LEXICAL)
+			proc = variable(l, first, env);
+		else
+			proc = eval(l, depth + 1, first, env);
+		if (is_vsubr(proc)) { /*eval their args on to the argument stack */
+			size_t at = l->args_used, argc = 0, i;
+			for (tmp = exp; is_cons(tmp); tmp = cdr(tmp), argc++) {
+				lisp_cell_t *x = eval(l, depth + 1, car(tmp), env);
+				i = lisp_args_reserve(l, 1);
+				l->args[i] = x;
+			}
+			if (!is_nil(tmp))
+				LISP_RECOVER(l, "%r\"evlis cannot eval dotted pairs\"%t\n '%S", exp);
+			l->cur_depth = depth;
+			l->cur_env = env;
+			l->gc_stack_used = gc_stack_save;
+			lisp_gc_add(l, proc);
+			lisp_validate_argv(l, proc, argc, l->args + at, 1);
+			ret = (*get_vsubr(proc)) (l, argc, l->args + at);
+			l->args_used = at;
+			DEBUG_RETURN(ret);
+		}
 		if (is_proc(proc) || is_subr(proc)) /*eval their args */
 			vals = evlis(l, depth + 1, exp, env);
 		else if (is_fproc(proc)) /*f-expr do not eval their args */
@@ -710,8 +1582,10 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 		}
 		if (is_proc(proc) || is_fproc(proc)) {
 			env = function_args(l, proc, vals);
-			exp = cons(l, l->progn, get_proc_code(proc));
-			goto tail;
+			if (l->vm_on && get_proc_bytecode(proc))
+				DEBUG_RETURN(vm_run(l, depth + 1, proc, env));
+			exp = get_proc_code(proc);
+			goto body;
 		}
 		LISP_RECOVER(l, "%r\"not a procedure\"%t\n '%S", first);
 		assert(0);
@@ -721,12 +1595,53 @@ lisp_cell_t *eval(lisp_t * l, unsigned depth, lisp_cell_t * exp, lisp_cell_t * e
 		FATAL("internal inconsistency: unknown type");
 	}
 	FATAL("internal inconsistency: reached the unreachable");
+body: /* a "progn" or procedure body, the last expression is a tail call */
+	if (is_nil(exp))
+		DEBUG_RETURN(l->nil);
+	for (; !is_nil(cdr(exp)); exp = cdr(exp)) {
+		TAIL_ROOTS();
+		(void)eval(l, depth + 1, car(exp), env);
+	}
+	exp = car(exp);
+	goto tail;
 debug:
 	lisp_log_debug(l, "%y'eval 'returned%t '%S", ret);
 	return ret;
+#undef TAIL_ROOTS
 #undef DEBUG_RETURN
 }
 
+lisp_cell_t *eval_body(lisp_t *l, unsigned depth, lisp_cell_t *body, lisp_cell_t *env) {
+	assert(l && body && env);
+	size_t gc_stack_save;
+	if (is_nil(body))
+		return l->nil;
+	lisp_gc_add(l, body);
+	lisp_gc_add(l, env);
+	gc_stack_save = l->gc_stack_used;
+	for (; !is_nil(cdr(body)); body = cdr(body)) {
+		(void)eval(l, depth, car(body), env);
+		l->gc_stack_used = gc_stack_save;
+	}
+	return eval(l, depth, car(body), env);
+}
+
+lisp_cell_t *lisp_subr_call(lisp_t * l, lisp_cell_t * x, lisp_cell_t * args) {
+	assert(l && x && is_subr(x) && args);
+	lisp_cell_t *ret;
+	size_t at = l->args_used, argc = 0, i;
+	lisp_validate_cell(l, x, args, 1);
+	if (!is_vsubr(x))
+		return (*get_subr(x)) (l, args);
+	for (; is_cons(args); args = cdr(args), argc++) {
+		i = lisp_args_reserve(l, 1);
+		l->args[i] = car(args);
+	}
+	ret = (*get_vsubr(x)) (l, argc, l->args + at);
+	l->args_used = at;
+	return ret;
+}
+
 /**< evaluate a list*/
 static lisp_cell_t *evlis(lisp_t * l, unsigned depth, lisp_cell_t * exps, lisp_cell_t * env) {
 	lisp_cell_t *start = exps;
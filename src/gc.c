@@ -8,22 +8,271 @@
 #include "private.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**@brief the number of data fields in a cell of each size class, the
+ * classes above five fields are only used by environment frames and the
+ * last class holds cons cells, which have two fields and no header*/
+static const size_t gc_class_fields[GC_SIZE_CLASSES] = { 1, 2, 4, 5, 8, GC_MAX_FIELDS, 2 };
+
+/**@brief map the number of data fields in a cell to the smallest size
+ * class that can hold it*/
+static size_t gc_class_of_count(size_t count) {
+	for (size_t i = 0; i < GC_CONS_CLASS; i++)
+		if (count <= gc_class_fields[i])
+			return i;
+	FATAL("internal inconsistency: no size class");
+	return 0;
+}
+
+/**@brief round "sz" up to the alignment required by the cell data*/
+static size_t gc_align(size_t sz) {
+	const size_t a = sizeof(cell_data_t);
+	return (sz + a - 1) / a * a;
+}
+
+/**@brief find the page a heap allocated cell lives in*/
+static gc_page_t *gc_page_of(lisp_cell_t *x) {
+	return (gc_page_t *)((uintptr_t)x & ~((uintptr_t)GC_PAGE_SIZE - 1));
+}
+
+/**@brief the index of a cell in its page, the tag on a pointer to a cons
+ * is less than the size of a slot so it makes no difference*/
+static size_t gc_index_of(gc_page_t *p, lisp_cell_t *x) {
+	return ((char *)x - p->base) / p->slot_size;
+}
+
+/**@brief the cell in slot "i" of a page, tagged if it is a cons*/
+static lisp_cell_t *gc_slot(gc_page_t *p, size_t i) {
+	char *x = p->base + i * p->slot_size;
+	return (lisp_cell_t *)(p->cons ? x + CONS_TAG : x);
+}
+
+/**@brief the field of a free slot the free list of a page is threaded
+ * through, a cons has no header to skip over*/
+static void **gc_free_link(gc_page_t *p, lisp_cell_t *x) {
+	return p->cons ? &((cell_data_t *)x)->v : &x->p[0].v;
+}
+
+/**@brief set or clear the bit for a cons cell in one of the bitmaps of its
+ * page that stand in for the flags in the header of other cells*/
+static void gc_cons_flag(uint64_t *bitmap, lisp_cell_t *x, int on) {
+	size_t i = gc_index_of(gc_page_of(x), x);
+	if (on)
+		bitmap[i / 64] |= (uint64_t)1 << (i % 64);
+	else
+		bitmap[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+/**@brief test the bit for a cons cell in a bitmap of its page*/
+static int gc_cons_flagged(uint64_t *bitmap, lisp_cell_t *x) {
+	size_t i = gc_index_of(gc_page_of(x), x);
+	return !!(bitmap[i / 64] & ((uint64_t)1 << (i % 64)));
+}
 
 void lisp_gc_used(lisp_cell_t *x) {
 	assert(x);
-	x->used = 1;
+	if (IS_CONS_PTR(x))
+		gc_cons_flag(gc_page_of(x)->used, x, 1);
+	else if (!IS_FIXNUM(x))
+		x->used = 1;
 }
 
 void lisp_gc_not_used(lisp_cell_t *x) {
 	assert(x);
-	x->used = 0;
+	if (IS_CONS_PTR(x))
+		gc_cons_flag(gc_page_of(x)->used, x, 0);
+	else if (!IS_FIXNUM(x))
+		x->used = 0;
+}
+
+int lisp_gc_resolved(lisp_cell_t *x) {
+	assert(x && IS_CONS_PTR(x));
+	return gc_cons_flagged(gc_page_of(x)->resolved, x);
+}
+
+void lisp_gc_set_resolved(lisp_cell_t *x) {
+	assert(x && IS_CONS_PTR(x));
+	gc_cons_flag(gc_page_of(x)->resolved, x, 1);
+}
+
+int lisp_gc_printing(lisp_cell_t *x) {
+	assert(x && IS_CONS_PTR(x));
+	return gc_cons_flagged(gc_page_of(x)->printing, x);
+}
+
+void lisp_gc_set_printing(lisp_cell_t *x, int on) {
+	assert(x && IS_CONS_PTR(x));
+	gc_cons_flag(gc_page_of(x)->printing, x, on);
+}
+
+/**@brief the marked cells in a word of a pages bitmaps, in a minor
+ * collection all old cells count as being marked*/
+static uint64_t gc_marked(lisp_t *l, gc_page_t *p, size_t w) {
+	return l->gc_minor ? p->mark[w] | p->old[w] : p->mark[w];
+}
+
+/**@brief set the mark bit of a cell in its pages bitmap, cells that are
+ * uncollectable might not live in a page (the special symbols are static)
+ * and are treated as always being marked
+ * @return int non zero if the cell was already marked*/
+static int gc_test_and_mark(lisp_t *l, lisp_cell_t *x) {
+	if (HAS_HEADER(x) && x->uncollectable)
+		return 1;
+	gc_page_t *p = gc_page_of(x);
+	size_t i = gc_index_of(p, x);
+	uint64_t bit = (uint64_t)1 << (i % 64);
+	if (gc_marked(l, p, i / 64) & bit)
+		return 1;
+	p->mark[i / 64] |= bit;
+	return 0;
+}
+
+/**@brief index of the lowest set bit in a non zero bitmap word*/
+static unsigned gc_lowest_bit(uint64_t w) {
+	assert(w);
+#ifdef __GNUC__
+	return __builtin_ctzll(w);
+#else
+	unsigned i = 0;
+	for (; !(w & 1); w >>= 1)
+		i++;
+	return i;
+#endif
+}
+
+/**@brief cut a new chunk of memory in to spare pages. Pages have to be
+ * aligned to their size, which C99 offers no way of asking for, so one
+ * page more than is needed is requested and the pages are placed from the
+ * first boundary in it. The slack is never touched.*/
+static void gc_chunk_new(lisp_t *l) {
+	const size_t size = (GC_CHUNK_PAGES + 1) * GC_PAGE_SIZE;
+	void *raw = malloc(size);
+	if (!raw)
+		lisp_out_of_memory(l);
+	gc_chunk_t *k = lisp_calloc(l, sizeof(*k));
+	uintptr_t start = ((uintptr_t)raw + GC_PAGE_SIZE - 1) & ~((uintptr_t)GC_PAGE_SIZE - 1);
+	k->raw = raw;
+	k->pages = ((uintptr_t)raw + size - start) / GC_PAGE_SIZE;
+	for (size_t i = 0; i < k->pages; i++) {
+		gc_page_t *p = (gc_page_t *)(start + i * GC_PAGE_SIZE);
+		p->chunk = k;
+		p->next = l->gc_spare;
+		l->gc_spare = p;
+	}
+	k->next = l->gc_chunks;
+	l->gc_chunks = k;
+	if ((l->gc_stats.heap_bytes += size) > l->gc_stats.heap_peak)
+		l->gc_stats.heap_peak = l->gc_stats.heap_bytes;
+}
+
+/**@brief give a page that is empty back to its chunk, the chunk is freed
+ * when none of its pages are in use*/
+static void gc_page_free(lisp_t *l, gc_page_t *p) {
+	gc_chunk_t *k = p->chunk, **link;
+	p->next = l->gc_spare;
+	l->gc_spare = p;
+	if (--k->used)
+		return;
+	for (gc_page_t **s = &l->gc_spare; *s;)
+		if ((*s)->chunk == k)
+			*s = (*s)->next;
+		else
+			s = &(*s)->next;
+	for (link = &l->gc_chunks; *link != k; link = &(*link)->next)
+		;
+	*link = k->next;
+	l->gc_stats.heap_bytes -= (GC_CHUNK_PAGES + 1) * GC_PAGE_SIZE;
+	free(k->raw);
+	free(k);
+}
+
+/**@brief get a new, empty, page for a size class*/
+static gc_page_t *gc_page_new(lisp_t *l, gc_size_class_t *c, gc_page_t *last) {
+	if (!l->gc_spare)
+		gc_chunk_new(l);
+	gc_page_t *p = l->gc_spare;
+	gc_chunk_t *k = p->chunk;
+	l->gc_spare = p->next;
+	memset(p, 0, sizeof(*p));
+	p->chunk = k;
+	k->used++;
+	p->base = (char *)p + gc_align(sizeof(*p));
+	p->slot_size = c->slot_size;
+	p->cons = c == &l->gc_classes[GC_CONS_CLASS];
+	p->epoch = l->gc_epoch;
+	p->slots = (GC_PAGE_SIZE - gc_align(sizeof(*p))) / c->slot_size;
+	assert(p->slots <= GC_BITMAP_WORDS * 64);
+	if (last)
+		last->next = p;
+	else
+		c->pages = p;
+	return p;
 }
 
-static void gc_free(lisp_t * l, lisp_cell_t * x) {
+lisp_cell_t *lisp_gc_alloc(lisp_t *l, lisp_type type, size_t count) {
+	assert(l && count);
+	size_t class = type == CONS ? GC_CONS_CLASS : gc_class_of_count(count);
+	gc_size_class_t *c = &l->gc_classes[class];
+	gc_page_t *p, *last = NULL;
+	lisp_cell_t *x;
+	size_t i;
+	if (!c->slot_size)
+		c->slot_size = class == GC_CONS_CLASS ? 2 * sizeof(cell_data_t) :
+			gc_align(sizeof(lisp_cell_t) + (gc_class_fields[class] - 1) * sizeof(cell_data_t));
+	for (p = c->cursor ? c->cursor : c->pages; p && (p->epoch != l->gc_epoch || (!p->free && p->bump == p->slots)); p = p->next)
+		last = p;
+	if (!p) /* pages are appended so the cursor never has to go back */
+		p = gc_page_new(l, c, last);
+	c->cursor = p;
+	if (p->free) {
+		x = p->free;
+		p->free = *gc_free_link(p, x);
+	} else {
+		x = (lisp_cell_t *)(p->base + p->bump++ * p->slot_size);
+	}
+	memset(x, 0, p->slot_size);
+	i = gc_index_of(p, x);
+	p->alloc[i / 64] |= (uint64_t)1 << (i % 64);
+	p->live++;
+	l->gc_bytes += p->slot_size;
+	if (p->cons) {
+		p->used[i / 64] &= ~((uint64_t)1 << (i % 64));
+		p->resolved[i / 64] &= ~((uint64_t)1 << (i % 64));
+		p->printing[i / 64] &= ~((uint64_t)1 << (i % 64));
+		return (lisp_cell_t *)((char *)x + CONS_TAG);
+	}
+	x->type = type;
+	return x;
+}
+
+void lisp_gc_release_all(lisp_t *l) {
+	assert(l);
+	for (size_t i = 0; i < GC_SIZE_CLASSES; i++)
+		l->gc_classes[i].pages = l->gc_classes[i].cursor = NULL;
+	for (gc_chunk_t *n, *k = l->gc_chunks; k; k = n) {
+		n = k->next;
+		free(k->raw);
+		free(k);
+	}
+	l->gc_chunks = NULL;
+	l->gc_spare = NULL;
+	l->gc_stats.heap_bytes = 0;
+}
+
+/**@brief release the resources a cell refers to, the cell itself is
+ * returned to its page by the caller
+ * @return int non zero if the cell was freed*/
+static int gc_free(lisp_t * l, lisp_cell_t * x) {
 	assert(l);
         /*assert(op) *//**< free a lisp cell*/
-	if (!x || x->uncollectable || x->used)
-		return;
+	if (!x)
+		return 0;
+	if (IS_CONS_PTR(x))
+		return !gc_cons_flagged(gc_page_of(x)->used, x);
+	if (x->uncollectable || x->used)
+		return 0;
 	switch (x->type) {
 	case INTEGER:
 	case CONS:
@@ -31,73 +280,133 @@ static void gc_free(lisp_t * l, lisp_cell_t * x) {
 	case PROC:
 	case SUBR:
 	case FPROC:
-		free(x);
+	case LEXICAL:
+	case FRAME:
+		break;
+	case CODE:
+		free(get_raw(x));
 		break;
 	case STRING:
 		free(get_str(x));
-		free(x);
 		break;
 	case SYMBOL:
 		free(get_sym(x));
-		free(x);
 		break;
 	case IO:
 		if (!x->close)
 			io_close(get_io(x));
-		free(x);
 		break;
 	case HASH:
 		hash_destroy(get_hash(x));
-		free(x);
 		break;
 	case USERDEF:
 		if (l->ufuncs[get_user_type(x)].free)
 			(l->ufuncs[get_user_type(x)].free) (x);
-		else
-			free(x);
 		break;
 	case INVALID:
 	default:
 		FATAL("internal inconsistency");
 		break;
 	}
+	return 1;
 }
 
-void lisp_gc_mark(lisp_t * l, lisp_cell_t * op) {
-	assert(l);
-        /*assert(op); *//**<recursively mark reachable cells*/
-	if (!op || op->mark)
+/**@brief put a marked cell on to the mark stack so it gets scanned*/
+static void gc_grey(lisp_t *l, lisp_cell_t *op) {
+	if (l->gc_mark_used < GC_MARK_STACK_SIZE) {
+		l->gc_mark_stack[l->gc_mark_used++] = op;
+		if (l->gc_mark_used > l->gc_stats.mark_stack_max)
+			l->gc_stats.mark_stack_max = l->gc_mark_used;
+	} else
+		l->gc_overflow = 1;
+}
+
+/**@brief mark a cell and, if it has children, push it on to the mark
+ * stack so they are scanned later. When the stack is full the cell is
+ * left marked but unscanned and the heap is rescanned afterwards*/
+static void gc_push(lisp_t *l, lisp_cell_t *op) {
+	if (!op || IS_FIXNUM(op) || gc_test_and_mark(l, op))
 		return;
-	op->mark = 1;
-	switch (op->type) {
+	switch (TYPE(op)) {
 	case INTEGER:
-	case SYMBOL:
 	case STRING:
 	case IO:
 	case FLOAT:
+		return;
+	case SYMBOL: /* only if it has a global value cell to scan */
+		if (op->uncollectable || !op->p[2].v)
+			return;
+		break;
+	default:
+		break;
+	}
+	gc_grey(l, op);
+}
+
+/**@brief push the children of a marked cell on to the mark stack, lists
+ * are followed along their "cdr" without using the stack at all
+ * @return size_t number of cells scanned, a measure of the work done*/
+static size_t gc_scan(lisp_t *l, lisp_cell_t *op) {
+	size_t work = 1, base;
+	switch (TYPE(op)) {
+	case INTEGER:
+	case STRING:
+	case IO:
+	case FLOAT:
+		break;
+	case SYMBOL:
+		if (!op->uncollectable)
+			gc_push(l, op->p[2].v);
 		break;
 	case SUBR:
-		lisp_gc_mark(l, get_func_docstring(op));
+		gc_push(l, get_func_docstring(op));
+		break;
+	case LEXICAL:
+		gc_push(l, op->p[0].v);
+		if (op->p[3].v)
+			gc_push(l, op->p[3].v);
+		break;
+	case CODE:
+		gc_push(l, op->p[1].v);
+		break;
+	case FRAME:
+		gc_push(l, op->p[0].v);
+		gc_push(l, get_frame_parent(op));
+		for (size_t i = 0; i < get_frame_count(op); i++)
+			gc_push(l, get_frame_value(op, i));
 		break;
 	case FPROC:
 	case PROC:
-		lisp_gc_mark(l, get_proc_args(op));
-		lisp_gc_mark(l, get_proc_code(op));
-		lisp_gc_mark(l, get_proc_env(op));
-		lisp_gc_mark(l, get_func_docstring(op));
+		gc_push(l, get_proc_args(op));
+		gc_push(l, get_proc_code(op));
+		gc_push(l, get_proc_env(op));
+		gc_push(l, get_func_docstring(op));
+		gc_push(l, get_proc_bytecode(op));
 		break;
 	case CONS:
-		lisp_gc_mark(l, car(op));
-		lisp_gc_mark(l, cdr(op));
+		for (base = l->gc_mark_used;;) {
+			gc_push(l, car(op));
+			op = cdr(op);
+			if (!is_cons(op) || gc_test_and_mark(l, op))
+				break;
+			if (++work > GC_SCAN_SPINE) { /* keep steps short */
+				gc_grey(l, op);
+				if (l->gc_mark_used > base + 1) { /* scan the cars first */
+					lisp_cell_t *t = l->gc_mark_stack[base];
+					l->gc_mark_stack[base] = op;
+					l->gc_mark_stack[l->gc_mark_used - 1] = t;
+				}
+				return work;
+			}
+		}
+		gc_push(l, op);
 		break;
 	case HASH:{
-			size_t i;
+			size_t i = 0;
 			hash_entry_t *cur;
 			hash_table_t *h = get_hash(op);
-			for (i = 0; i < h->len; i++)
-				if (h->table[i])
-					for (cur = h->table[i]; cur; cur = cur->next)
-						lisp_gc_mark(l, cur->val);
+			while ((cur = hash_iterate(h, &i)))
+				gc_push(l, cur->val), work++;
 		}
 		break;
 	case USERDEF:
@@ -108,25 +417,113 @@ void lisp_gc_mark(lisp_t * l, lisp_cell_t * op) {
 	default:
 		FATAL("internal inconsistency: unknown type");
 	}
+	return work;
 }
 
-void lisp_gc_sweep_only(lisp_t * l) {
+/**@brief scan cells on the mark stack until it is empty*/
+static void gc_drain(lisp_t *l) {
+	while (l->gc_mark_used)
+		gc_scan(l, l->gc_mark_stack[--l->gc_mark_used]);
+}
+
+/**@brief recover from a mark stack overflow by scanning every marked cell
+ * in the heap again, cells that were dropped from the stack will have
+ * their children marked this time around*/
+static void gc_rescan(lisp_t *l) {
+	while (l->gc_overflow) {
+		l->gc_overflow = 0;
+		for (size_t i = 0; i < GC_SIZE_CLASSES; i++)
+			for (gc_page_t *p = l->gc_classes[i].pages; p; p = p->next)
+				for (size_t w = 0; w < GC_BITMAP_WORDS; w++)
+					for (uint64_t m = gc_marked(l, p, w); m; m &= m - 1) {
+						size_t j = w * 64 + gc_lowest_bit(m);
+						gc_scan(l, gc_slot(p, j));
+						gc_drain(l);
+					}
+	}
+}
+
+void lisp_gc_mark(lisp_t * l, lisp_cell_t * op) {
 	assert(l);
-	if (l->gc_off)
+	gc_push(l, op);
+	if (l->gc_marking) /* called from a user defined mark function */
 		return;
-	for (gc_list_t **p = &l->gc_head; *p != NULL;) {
-		gc_list_t *v = *p;
-		if (v->ref->mark) {
-			p = &v->next;
-			v->ref->mark = 0;
-		} else {
-			*p = v->next;
-			gc_free(l, v->ref);
-			free(v);
+	l->gc_marking = 1;
+	gc_drain(l);
+	gc_rescan(l);
+	l->gc_marking = 0;
+}
+
+/**@brief sweep a single page, returning free slots to its free list
+ * @return size_t the number of cells still alive in the page*/
+static size_t gc_sweep_page(lisp_t *l, gc_page_t *p) {
+	for (size_t w = 0; w < GC_BITMAP_WORDS; w++) {
+		uint64_t dead = p->alloc[w] & ~gc_marked(l, p, w);
+		p->mark[w] = 0;
+		while (dead) {
+			unsigned bit = gc_lowest_bit(dead);
+			lisp_cell_t *x = gc_slot(p, w * 64 + bit);
+			dead &= dead - 1;
+			if (!gc_free(l, x))
+				continue;
+			l->gc_stats.freed[TYPE(x)]++;
+			p->alloc[w] &= ~((uint64_t)1 << bit);
+			if (p->cons)
+				x = (lisp_cell_t *)CONS_FIELDS(x);
+			else
+				x->type = INVALID;
+			*gc_free_link(p, x) = p->free;
+			p->free = x;
+			p->live--;
+			l->gc_bytes -= p->slot_size;
 		}
+		p->old[w] = l->gc_generational ? p->alloc[w] : 0;
+		p->dirty[w] &= p->alloc[w];
+	}
+	p->epoch = l->gc_epoch;
+	return p->live;
+}
+
+/**@brief sweep the page "*link" points to, freeing it if it is empty
+ * @return gc_page_t** link to the page after it*/
+static gc_page_t **gc_sweep_link(lisp_t *l, gc_size_class_t *c, gc_page_t **link) {
+	gc_page_t *v = *link;
+	size_t live = gc_sweep_page(l, v);
+	l->gc_live += live;
+	if (live)
+		return &v->next;
+	if (c->cursor == v)
+		c->cursor = v->next;
+	*link = v->next;
+	gc_page_free(l, v);
+	return link;
+}
+
+/**@brief sweep every page in the heap in one go*/
+static void gc_sweep_all(lisp_t *l) {
+	l->gc_live = 0;
+	for (size_t i = 0; i < GC_SIZE_CLASSES; i++) {
+		gc_size_class_t *c = &l->gc_classes[i];
+		for (gc_page_t **p = &c->pages; *p != NULL;)
+			p = gc_sweep_link(l, c, p);
+		c->cursor = c->pages;
 	}
 }
 
+void lisp_gc_sweep_only(lisp_t * l) {
+	assert(l);
+	if (l->gc_off)
+		return;
+	l->gc_phase = GC_IDLE;
+	l->gc_minor = 0;
+	l->gc_mark_used = 0;
+	l->gc_overflow = 0;
+	for (size_t i = 0; i < GC_SIZE_CLASSES; i++)
+		for (gc_page_t *p = l->gc_classes[i].pages; p; p = p->next)
+			memset(p->mark, 0, sizeof(p->mark));
+	gc_sweep_all(l);
+}
+
 lisp_cell_t *lisp_gc_add(lisp_t * l, lisp_cell_t * op) {
 	assert(l);
 	if (l->gc_stack_used++ > l->gc_stack_allocated - 1) {
@@ -142,6 +539,25 @@ lisp_cell_t *lisp_gc_add(lisp_t * l, lisp_cell_t * op) {
 	return op;
 }
 
+size_t lisp_args_reserve(lisp_t *l, size_t n) {
+	assert(l);
+	size_t at = l->args_used;
+	if (at + n > l->args_allocated) {
+		size_t len = (at + n) * 2;
+		if (len < at + n)
+			LISP_HALT(l, "%s", "overflow in allocator size variable");
+		lisp_cell_t **olist = realloc(l->args, len * sizeof(*l->args));
+		if (!olist)
+			lisp_out_of_memory(l);
+		l->args = olist;
+		l->args_allocated = len;
+	}
+	for (size_t i = at; i < at + n; i++)
+		l->args[i] = l->nil;
+	l->args_used = at + n;
+	return at;
+}
+
 int lisp_gc_status(lisp_t * l) {
 	assert(l);
 	return !l->gc_off;
@@ -157,15 +573,232 @@ void lisp_gc_off(lisp_t * l) {
 	l->gc_off = 1;
 }
 
+void lisp_gc_write_barrier(lisp_cell_t *x) {
+	assert(x);
+	if (IS_FIXNUM(x) || (HAS_HEADER(x) && x->uncollectable))
+		return;
+	gc_page_t *p = gc_page_of(x);
+	size_t i = gc_index_of(p, x);
+	uint64_t bit = (uint64_t)1 << (i % 64);
+	if ((p->old[i / 64] | p->mark[i / 64]) & bit) {
+		p->dirty[i / 64] |= bit;
+		p->has_dirty = 1;
+	}
+}
+
+void lisp_gc_set_generational(lisp_t *l, int on) {
+	assert(l);
+	l->gc_generational = !!on;
+}
+
+void lisp_gc_set_incremental(lisp_t *l, int on) {
+	assert(l);
+	l->gc_incremental = !!on;
+}
+
+void lisp_gc_set_pause(lisp_t *l, unsigned percent) {
+	assert(l);
+	l->gc_pause = percent;
+}
+
+void lisp_gc_set_step_multiplier(lisp_t *l, unsigned percent) {
+	assert(l);
+	l->gc_stepmul = percent;
+}
+
+void lisp_gc_set_step_budget(lisp_t *l, size_t cells, size_t usecs) {
+	assert(l);
+	l->gc_budget_cells = cells;
+	l->gc_budget_usecs = usecs;
+}
+
+/**@brief begin a collection, in a minor collection old cells count as
+ * being marked so the trace stops as soon as it reaches one. Old cells
+ * written to since the last collection are found by gc_finish_mark().*/
+static void gc_start(lisp_t *l, int minor) {
+	l->gc_minor = minor;
+	l->gc_marking = 1;
+	gc_push(l, l->all_symbols);
+	gc_push(l, l->top_env);
+	l->gc_marking = 0;
+	l->gc_phase = GC_MARK;
+}
+
+/**@brief finish marking without interruption. The roots are marked again,
+ * as the stack of temporary variables has no barrier, and so are cells
+ * that were written to after they were marked (for an incremental
+ * collection) or promoted (for a minor one), which are flagged as dirty.
+ * Starting a new epoch makes every existing page unswept.*/
+static void gc_finish_mark(lisp_t *l) {
+	l->gc_marking = 1;
+	gc_push(l, l->all_symbols);
+	gc_push(l, l->top_env);
+	for (size_t i = 0; i < l->gc_stack_used; i++) {
+		gc_push(l, l->gc_stack[i]);
+		gc_drain(l);
+	}
+	for (size_t i = 0; i < l->args_used; i++) {
+		gc_push(l, l->args[i]);
+		gc_drain(l);
+	}
+	for (size_t i = 0; i < GC_SIZE_CLASSES; i++)
+		for (gc_page_t *p = l->gc_classes[i].pages; p; p = p->next) {
+			if (!p->has_dirty)
+				continue;
+			for (size_t w = 0; w < GC_BITMAP_WORDS; w++) {
+				for (uint64_t d = p->dirty[w] & gc_marked(l, p, w); d; d &= d - 1) {
+					size_t j = w * 64 + gc_lowest_bit(d);
+					gc_scan(l, gc_slot(p, j));
+					gc_drain(l);
+				}
+				p->dirty[w] = 0;
+			}
+			p->has_dirty = 0;
+		}
+	gc_drain(l);
+	gc_rescan(l);
+	l->gc_marking = 0;
+	l->gc_phase = GC_SWEEP;
+	l->gc_live = 0;
+	l->gc_sweep_class = 0;
+	l->gc_sweep_at = &l->gc_classes[0].pages;
+	l->gc_epoch++;
+}
+
+/**@brief the end of a collection, once every page has been swept. The
+ * next one starts when the heap has grown by "gc_pause" percent of what
+ * is in use now, so a program with a large heap collects less often.*/
+static void gc_end(lisp_t *l) {
+	l->gc_stats.collections++;
+	l->gc_stats.bytes_live = l->gc_bytes;
+	if (l->gc_minor)
+		l->gc_stats.minor_collections++;
+	else
+		l->gc_major_live = l->gc_live;
+	l->gc_minor = 0;
+	l->gc_phase = GC_IDLE;
+	l->gc_threshold = l->gc_bytes / 100 * l->gc_pause;
+	if (l->gc_threshold < GC_HEAP_MINIMUM)
+		l->gc_threshold = GC_HEAP_MINIMUM;
+}
+
+/**@brief has a step used up its budget of cells or time? Without an
+ * explicit budget a step processes "gc_stepmul" percent of the cells that
+ * could have been allocated since the last one, so that the collection
+ * keeps ahead of the program.*/
+static int gc_budget_spent(lisp_t *l, size_t work, clock_t start) {
+	size_t cells = l->gc_budget_cells;
+	if (!cells && !l->gc_budget_usecs)
+		cells = GC_STEP_SIZE / sizeof(lisp_cell_t) * l->gc_stepmul / 100 + 1;
+	if (cells && work >= cells)
+		return 1;
+	if (l->gc_budget_usecs)
+		return (clock() - start) * 1000000.0 / CLOCKS_PER_SEC >= l->gc_budget_usecs;
+	return 0;
+}
+
+/**@brief perform a bounded amount of marking or sweeping, the budget is
+ * only checked every so often as reading the clock is not free*/
+static void gc_step(lisp_t *l) {
+	clock_t start = l->gc_budget_usecs ? clock() : 0;
+	size_t work = 0, check = 64;
+	while (l->gc_phase == GC_MARK) {
+		if (!l->gc_mark_used) {
+			gc_finish_mark(l);
+			return;
+		}
+		l->gc_marking = 1;
+		work += gc_scan(l, l->gc_mark_stack[--l->gc_mark_used]);
+		l->gc_marking = 0;
+		if (work >= check) {
+			if (gc_budget_spent(l, work, start))
+				return;
+			check = work + 64;
+		}
+	}
+	while (l->gc_phase == GC_SWEEP) {
+		gc_size_class_t *c = &l->gc_classes[l->gc_sweep_class];
+		if (!*l->gc_sweep_at || (*l->gc_sweep_at)->epoch == l->gc_epoch) {
+			c->cursor = c->pages;
+			if (++l->gc_sweep_class == GC_SIZE_CLASSES) {
+				gc_end(l);
+				return;
+			}
+			l->gc_sweep_at = &l->gc_classes[l->gc_sweep_class].pages;
+			continue;
+		}
+		work += (*l->gc_sweep_at)->slots / 16 + 1;
+		l->gc_sweep_at = gc_sweep_link(l, c, l->gc_sweep_at);
+		if (gc_budget_spent(l, work, start))
+			return;
+	}
+}
+
+/**@brief complete any collection in progress without interruption*/
+static void gc_finish(lisp_t *l) {
+	if (l->gc_phase == GC_MARK) {
+		l->gc_marking = 1;
+		gc_drain(l);
+		l->gc_marking = 0;
+		gc_finish_mark(l);
+	}
+	if (l->gc_phase == GC_SWEEP) {
+		for (; l->gc_sweep_class < GC_SIZE_CLASSES; l->gc_sweep_class++) {
+			gc_size_class_t *c = &l->gc_classes[l->gc_sweep_class];
+			for (gc_page_t **p = &c->pages; *p != NULL;)
+				p = (*p)->epoch != l->gc_epoch ? gc_sweep_link(l, c, p) : &(*p)->next;
+			c->cursor = c->pages;
+		}
+		gc_end(l);
+	}
+}
+
+/**@brief add the time the program has been kept waiting since "start" to
+ * the pause statistics*/
+static void gc_pause(lisp_t *l, clock_t start) {
+	double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+	l->gc_stats.pause_total += t;
+	if (t > l->gc_stats.pause_max)
+		l->gc_stats.pause_max = t;
+}
+
+/**@brief mark everything reachable from the roots then sweep, a minor
+ * collection only traces and frees cells allocated since the last one*/
+static void gc_mark_and_sweep(lisp_t *l, int minor) {
+	gc_finish(l);
+	gc_start(l, minor);
+	gc_finish(l);
+}
+
+void lisp_gc_collect(lisp_t *l) {
+	assert(l);
+	if (l->gc_off)
+		return;
+	int minor = l->gc_generational && l->gc_live < 2 * l->gc_major_live;
+	clock_t start = clock();
+	if (!l->gc_incremental && l->gc_phase == GC_IDLE) {
+		gc_mark_and_sweep(l, minor);
+		gc_pause(l, start);
+		return;
+	}
+	if (l->gc_phase == GC_IDLE)
+		gc_start(l, minor);
+	gc_step(l);
+	if (l->gc_phase != GC_IDLE) /* step again after a few more allocations */
+		l->gc_threshold = l->gc_bytes + GC_STEP_SIZE;
+	gc_pause(l, start);
+}
+
 void lisp_gc_mark_and_sweep(lisp_t * l) {
 	assert(l);
 	if (l->gc_off)
 		return;
-	lisp_gc_mark(l, l->all_symbols);
-	lisp_gc_mark(l, l->top_env);
-	for (size_t i = 0; i < l->gc_stack_used; i++)
-		lisp_gc_mark(l, l->gc_stack[i]);
-	lisp_gc_sweep_only(l);
-	l->gc_collectp = 0;
+	clock_t start = clock();
+	gc_mark_and_sweep(l, 0);
+	gc_pause(l, start);
 }
 
+const lisp_gc_stats_t *lisp_gc_stats(lisp_t *l) {
+	assert(l);
+	return &l->gc_stats;
+}
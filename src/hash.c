@@ -3,16 +3,39 @@
  *  @author     Richard Howe (2015)
  *  @license    LGPL v2.1 or Later
  *  @email      howe.r.j.89@gmail.com
- *  @todo Change to linear probing, making this into a generic table for use in the
- *        lisp interpreter, make a custom callback for hashing lisp code,
- *        simplifying all of the hash stuff instead of cons the key and value
- *        and storing that. **/
+ *
+ *  The table uses open addressing with Robin Hood probing, an entry that
+ *  is further from its bin than the one in its way takes that bin and the
+ *  displaced entry carries on probing. This keeps probe sequences short,
+ *  and as there are no empty bins within a sequence a lookup can stop as
+ *  soon as it sees an entry closer to its bin than the key would be.
+ *  Alongside the entries is an array of bytes, one per bin, holding the
+ *  distance of the entry from its bin, so probing rarely looks at an
+ *  entry that cannot match, and entries keep the hash of their key so
+ *  the key only gets compared when the hashes are equal.
+ *
+ *  The number of bins is a power of two so a bin can be selected by
+ *  masking off the low bits of a hash. Every table has its own randomly
+ *  chosen seed that the hash function uses, so that keys from untrusted
+ *  input cannot be picked to all land in the same bins.
+ *
+ *  A table is resized a little at a time, so no single insertion has to
+ *  move every entry. New bins are allocated and each insertion or removal
+ *  moves a few of the old bins into them, until then a lookup checks both.
+ *  @todo Make a custom callback for hashing lisp code, simplifying all of
+ *        the hash stuff instead of cons the key and value and storing that. **/
 
 #include "liblisp.h"
 #include "private.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#define HASH_MAX_LOAD  (0.75) /**< grow the table before the load factor exceeds this*/
+#define HASH_MIN_LOAD  (0.20) /**< shrink the table when the load factor falls below this...*/
+#define HASH_MIN_BINS  (16)   /**< ...unless it would end up with fewer bins than this*/
+#define HASH_MOVE_STEP (16)   /**< bins moved per insertion or removal when resizing*/
 
 /************************ small hash library **********************************/
 
@@ -25,41 +48,164 @@ static int string_compare(const void *a, const void *b) {
 	return strcmp((const char*)a, (const char*)b);
 }
 
-static uint32_t string_hash(const void *s) {
+uint32_t hash_string(const char *s, size_t len, uint64_t seed) {
 	assert(s);
-	return djb2(s, strlen(s));
+	return wyhash(s, len, seed);
 }
 
-static uint32_t hash_alg(const hash_table_t * table, const void *s) {
-	assert(table->len);
-	return table->hash(s) % table->len;
+static uint32_t string_hash(const void *s, uint64_t seed) {
+	assert(s);
+	return hash_string(s, strlen(s), seed);
 }
 
-/**@brief internal function to create a chained hash node**/
-static hash_entry_t *hash_new_pair(char *key, void *val) {
-	if (!key || !val)
-		return NULL;
-	hash_entry_t *np = calloc(1, sizeof(*np));
-	if (!np)
+/**@brief hash a key with the seed of a table, the hash of a function that
+ * takes no seed is mixed with it afterwards*/
+static uint32_t hash_key(const hash_table_t *h, const void *key) {
+	if (h->unseeded) {
+		uint32_t u = h->unseeded(key);
+		return wyhash(&u, sizeof(u), h->seed);
+	}
+	return h->hash(key, h->seed);
+}
+
+/* this is not cryptographically secure, but it varies with the time, the
+ * address given and, with address space layout randomization, the
+ * addresses of the stack */
+uint64_t hash_new_seed(const void *p) {
+	uint64_t x = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32);
+	x = wyhash(&x, sizeof(x), (uint64_t)(uintptr_t)p);
+	return wyhash(&x, sizeof(x), (uint64_t)(uintptr_t)&x);
+}
+
+static size_t hash_alg(const hash_bins_t *b, uint32_t hash) {
+	assert(b->len);
+	return hash & (b->len - 1);
+}
+
+static uint32_t hash_distance(const hash_bins_t *b, size_t i) {
+	return b->meta[i] < UINT8_MAX ? b->meta[i] : b->table[i].distance;
+}
+
+static void hash_set(hash_bins_t *b, size_t i, hash_entry_t *e) {
+	b->table[i] = *e;
+	b->meta[i] = e->distance < UINT8_MAX ? e->distance : UINT8_MAX;
+}
+
+/**@brief put an entry into a set of bins, this does not check whether
+ * the key is already present, and there must be an empty bin*/
+static void hash_place(hash_bins_t *b, hash_entry_t e) {
+	size_t i = hash_alg(b, e.hash);
+	for (e.distance = 1;; e.distance++) {
+		if (!b->meta[i]) {
+			hash_set(b, i, &e);
+			return;
+		}
+		if (hash_distance(b, i) < e.distance) { /*the entry here is closer to its bin*/
+			hash_entry_t t = b->table[i];
+			hash_set(b, i, &e);
+			e = t;
+		}
+		if (++i == b->len)
+			i = 0;
+	}
+}
+
+/**@brief remove the entry in bin "i", the entries after it that are not
+ * in their own bin are moved back one so no gap is left*/
+static void hash_unplace(hash_bins_t *b, size_t i) {
+	for (size_t next; ; i = next) {
+		next = i + 1 == b->len ? 0 : i + 1;
+		if (hash_distance(b, next) <= 1)
+			break;
+		b->table[next].distance--;
+		hash_set(b, i, &b->table[next]);
+	}
+	b->meta[i] = 0;
+}
+
+static hash_entry_t *hash_find(const hash_table_t *h, const hash_bins_t *b, const char *key, uint32_t hash) {
+	if (!b->len)
 		return NULL;
-	np->key = (char *)key;
-	np->val = val;
-	return np;
+	size_t i = hash_alg(b, hash);
+	for (uint32_t d = 1; hash_distance(b, i) >= d; d++) {
+		if (b->table[i].hash == hash && !h->compare(b->table[i].key, key))
+			return &b->table[i];
+		if (++i == b->len)
+			i = 0;
+	}
+	return NULL;
+}
+
+static int hash_bins_alloc(hash_bins_t *b, size_t len) {
+	b->table = calloc(len, sizeof(*b->table));
+	b->meta = calloc(len, sizeof(*b->meta));
+	b->len = len;
+	if (b->table && b->meta)
+		return 0;
+	free(b->table);
+	free(b->meta);
+	memset(b, 0, sizeof(*b));
+	return -1;
+}
+
+static void hash_bins_free(hash_bins_t *b) {
+	free(b->table);
+	free(b->meta);
+	memset(b, 0, sizeof(*b));
+}
+
+/**@brief move up to "n" of the old bins of a table being resized*/
+static void hash_move(hash_table_t *h, size_t n) {
+	hash_bins_t *o = &h->old;
+	if (!o->len)
+		return;
+	for (; n && h->moved < o->len; n--, h->moved++)
+		while (o->meta[h->moved]) { /*entries can be moved back into this bin*/
+			hash_place(&h->bins, o->table[h->moved]);
+			hash_unplace(o, h->moved);
+		}
+	if (h->moved == o->len) {
+		hash_bins_free(o);
+		h->moved = 0;
+	}
+}
+
+/**@brief start moving the entries of a table into "len" new bins, any
+ * resize already in progress is finished first
+ * @return int 0 on success, < 0 on failure*/
+static int hash_resize(hash_table_t *h, size_t len) {
+	hash_bins_t b;
+	assert(len > h->used);
+	hash_move(h, SIZE_MAX);
+	if (hash_bins_alloc(&b, len) < 0)
+		return -1;
+	h->old = h->bins;
+	h->bins = b;
+	h->moved = 0;
+	return 0;
 }
 
 hash_table_t *hash_create(const size_t len) {
-	return hash_create_custom(len, null_free, null_free, string_compare, string_hash);
+	return hash_create_custom_seeded(len, null_free, null_free, string_compare, string_hash);
 }
 
 hash_table_t *hash_create_custom(size_t len, hash_free_key_f k, hash_free_val_f v, hash_compare_key_f c, hash_f h) {
-	if (!len)
-		len++;
+	hash_table_t *nt = hash_create_custom_seeded(len, k, v, c, NULL);
+	if (nt)
+		nt->unseeded = h;
+	return nt;
+}
+
+hash_table_t *hash_create_custom_seeded(size_t len, hash_free_key_f k, hash_free_val_f v, hash_compare_key_f c, hash_seeded_f h) {
+	size_t bins = 1;
+	while (bins < len && bins * 2 > bins)
+		bins *= 2;
 	hash_table_t *nt = calloc(1, sizeof(*nt));
 	if (!nt)
 		return NULL;
-	if (!(nt->table = calloc(len, sizeof(*nt->table))))
+	if (hash_bins_alloc(&nt->bins, bins) < 0)
 		return free(nt), NULL;
-	nt->len = len;
+	nt->seed     = hash_new_seed(nt);
 	nt->free_key = k;
 	nt->free_val = v;
 	nt->compare  = c;
@@ -67,127 +213,118 @@ hash_table_t *hash_create_custom(size_t len, hash_free_key_f k, hash_free_val_f
 	return nt;
 }
 
+hash_table_t *hash_create_seeded(size_t len, uint64_t seed) {
+	hash_table_t *h = hash_create(len);
+	if (h)
+		h->seed = seed;
+	return h;
+}
+
 void hash_destroy(hash_table_t * h) {
 	if (!h)
 		return;
-	for (size_t i = 0; i < h->len; i++)
-		if (h->table[i]) {
-			hash_entry_t *prev = NULL;
-			for (hash_entry_t *cur = h->table[i]; cur; prev = cur, cur = cur->next) {
-				h->free_key(cur->key);
-				h->free_val(cur->val);
-				cur->key = NULL;
-				cur->val = NULL;
-				free(prev);
-				prev = NULL;
-			}
-			free(prev);
-		}
-	free(h->table);
-	h->table = NULL;
+	size_t i = 0;
+	for (hash_entry_t *cur; (cur = hash_iterate(h, &i));) {
+		h->free_key(cur->key);
+		h->free_val(cur->val);
+	}
+	hash_bins_free(&h->bins);
+	hash_bins_free(&h->old);
 	free(h);
 }
 
-static hash_table_t *hash_copy_and_resize(hash_table_t *old, const size_t len) {
-	assert(old);
-	hash_table_t *new = hash_create(len);
+hash_table_t *hash_copy(hash_table_t *src) {
+	assert(src);
+	hash_move(src, SIZE_MAX);
+	hash_table_t *new = hash_create_custom_seeded(src->bins.len, src->free_key, src->free_val, src->compare, src->hash);
 	if (!new)
 		return NULL;
-	for (size_t i = 0; i < old->len; i++)
-		if (old->table[i])
-			for (hash_entry_t *cur = old->table[i]; cur; cur = cur->next)
-				if (hash_insert(new, cur->key, cur->val) < 0)
-					goto fail;
-	new->free_key = old->free_key;
-	new->free_val = old->free_val;
-	new->compare = old->compare;
-	new->hash = old->hash;
+	new->unseeded = src->unseeded;
+	memcpy(new->bins.table, src->bins.table, src->bins.len * sizeof(*src->bins.table));
+	memcpy(new->bins.meta, src->bins.meta, src->bins.len * sizeof(*src->bins.meta));
+	new->used = src->used;
+	new->seed = src->seed; /*the cached hashes depend on it*/
 	return new;
-fail:
-	hash_destroy(new);
-	return NULL;
 }
 
-hash_table_t *hash_copy(hash_table_t *src) {
-	assert(src);
-	return hash_copy_and_resize(src, src->len);
+int hash_insert(hash_table_t * ht, char *key, void *val) {
+	assert(ht && key);
+	return hash_insert_hashed(ht, key, hash_key(ht, key), ht->seed, val);
 }
 
-static int hash_grow(hash_table_t * ht) {
-	assert(ht);
-	if ((ht->len * 2) < ht->len)
-		return -1;
-	hash_table_t *new = hash_copy_and_resize(ht, ht->len*2);
-	if (!new)
-		return -1;
-	for (size_t i = 0; i < ht->len; i++)
-		if (ht->table[i]) {
-			hash_entry_t *cur = NULL, *prev = NULL;
-			for (cur = ht->table[i]; cur; prev = cur, cur = cur->next)
-				free(prev);
-			free(prev);
-		}
-	free(ht->table);
-	ht->table = new->table;
-	ht->len = new->len;
-	free(new);
+int hash_insert_hashed(hash_table_t *ht, char *key, uint32_t hash, uint64_t seed, void *val) {
+	assert(ht && key && val);
+	if (ht->hash != string_hash || ht->seed != seed)
+		hash = hash_key(ht, key);
+	hash_entry_t e = { .key = key, .val = val, .hash = hash }, *cur;
+	if ((cur = hash_find(ht, &ht->bins, key, e.hash)) || (cur = hash_find(ht, &ht->old, key, e.hash))) {
+		ht->replacements++;
+		if (cur->key != key) /*the new key lives as long as the new value*/
+			ht->free_key(cur->key);
+		cur->key = key;
+		cur->val = val;	/*replace */
+		return 0;
+	}
+	if (ht->used + 1 > ht->bins.len * HASH_MAX_LOAD)
+		if (ht->bins.len * 2 < ht->bins.len || hash_resize(ht, ht->bins.len * 2) < 0)
+			if (ht->used + 1 >= ht->bins.len)
+				return -1;
+	hash_move(ht, HASH_MOVE_STEP);
+	if (ht->bins.meta[hash_alg(&ht->bins, e.hash)])
+		ht->collisions++;
+	hash_place(&ht->bins, e);
+	ht->used++;
 	return 0;
 }
 
-int hash_insert(hash_table_t * ht, char *key, void *val) {
-	assert(ht && key && val);
-	hash_entry_t *cur = NULL, *newt = NULL, *last = NULL;
-
-	if (hash_get_load_factor(ht) >= 0.75f)
-		hash_grow(ht); /**@warning grow must go before any other operation*/
+int hash_remove(hash_table_t *h, const char *key) {
+	assert(h && key);
+	return hash_remove_hashed(h, key, hash_key(h, key), h->seed);
+}
 
-	const uint32_t hash = hash_alg(ht, key);
-	for (cur = ht->table[hash]; cur && cur->key && ht->compare(key, cur->key); cur = cur->next)
-		last = cur;
+int hash_remove_hashed(hash_table_t *h, const char *key, uint32_t hash, uint64_t seed) {
+	assert(h && key);
+	if (h->hash != string_hash || h->seed != seed)
+		hash = hash_key(h, key);
+	hash_bins_t *b = &h->bins;
+	hash_entry_t *cur = hash_find(h, b, key, hash);
+	if (!cur && !(cur = hash_find(h, b = &h->old, key, hash)))
+		return -1;
+	h->free_key(cur->key);
+	h->free_val(cur->val);
+	hash_unplace(b, cur - b->table);
+	h->used--;
+	hash_move(h, HASH_MOVE_STEP);
+	if (!h->old.len && h->bins.len / 2 >= HASH_MIN_BINS && h->used < h->bins.len * HASH_MIN_LOAD)
+		hash_resize(h, h->bins.len / 2); /*if this fails the table is just bigger than it needs to be*/
+	return 0;
+}
 
-	if (cur && cur->key && !(ht->compare(key, cur->key))) {
-		ht->replacements++;
-		cur->val = val;	/*replace */
-	} else {
-		if (!(newt = hash_new_pair(key, val)))
-			return -1;
-		ht->used++;
-		if (cur == ht->table[hash]) {	/*collisions, insert head */
-			ht->collisions++;
-			newt->next = cur;
-			ht->table[hash] = newt;
-		} else if (!cur) {	/*free bin */
-			last->next = newt;
-		} else {	/*collision, insertions */
-			ht->collisions++;
-			newt->next = cur;
-			last->next = newt;
+hash_entry_t *hash_iterate(const hash_table_t *h, size_t *i) {
+	assert(h && i);
+	for (; *i < h->bins.len + h->old.len; (*i)++) {
+		const hash_bins_t *b = *i < h->bins.len ? &h->bins : &h->old;
+		size_t j = *i < h->bins.len ? *i : *i - h->bins.len;
+		if (b->meta[j]) {
+			(*i)++;
+			return &b->table[j];
 		}
 	}
-	return 0;
+	return NULL;
 }
 
 void *hash_foreach(hash_table_t * h, hash_func func) {
 	assert(h && func);
-	size_t i = 0;
-	hash_entry_t *cur = NULL;
-	if (h->foreach) {
-		i = h->foreach_index;
-		cur = h->foreach_cur;
-		goto resume;
-	}
+	size_t i = h->foreach ? h->foreach_index : 0;
+	hash_entry_t *cur;
 	h->foreach = 1;
-	for (i = 0; i < h->len; i++)
-		if (h->table[i])
-			for (cur = h->table[i]; cur;) {
-				void *ret = (*func) (cur->key, cur->val);
-				if (ret) {
-					h->foreach_index = i;
-					h->foreach_cur = cur;
-					return ret;
-				}
- resume:			cur = cur->next;
-			}
+	while ((cur = hash_iterate(h, &i))) {
+		void *ret = (*func) (cur->key, cur->val);
+		if (ret) {
+			h->foreach_index = i;
+			return ret;
+		}
+	}
 	h->foreach = 0;
 	return NULL;
 }
@@ -208,8 +345,8 @@ void hash_print(const hash_table_t * h) {
 }
 
 double hash_get_load_factor(const hash_table_t * h) {
-	assert(h && h->len);
-	return (double)h->used / h->len;
+	assert(h && h->bins.len);
+	return (double)h->used / h->bins.len;
 }
 
 size_t hash_get_collision_count(const hash_table_t * h) {
@@ -224,18 +361,25 @@ size_t hash_get_replacements(const hash_table_t * h) {
 
 size_t hash_get_number_of_bins(const hash_table_t * h) {
 	assert(h);
-	return h->len;
+	return h->bins.len;
+}
+
+size_t hash_get_bins_to_move(const hash_table_t * h) {
+	assert(h);
+	return h->old.len - h->moved;
 }
 
 void *hash_lookup(const hash_table_t * h, const char *key) {
 	assert(h && key);
-	const uint32_t hash = hash_alg(h, key);
-	hash_entry_t *cur = h->table[hash];
-	while (cur && cur->next && h->compare(cur->key, key))
-		cur = cur->next;
-	if (!cur || !cur->key || h->compare(cur->key, key))
-		return NULL;
-	else
-		return cur->val;
+	return hash_lookup_hashed(h, key, hash_key(h, key), h->seed);
 }
 
+void *hash_lookup_hashed(const hash_table_t *h, const char *key, uint32_t hash, uint64_t seed) {
+	assert(h && key);
+	if (h->hash != string_hash || h->seed != seed)
+		hash = hash_key(h, key);
+	hash_entry_t *cur = hash_find(h, &h->bins, key, hash);
+	if (!cur && !(cur = hash_find(h, &h->old, key, hash)))
+		return NULL;
+	return cur->val;
+}
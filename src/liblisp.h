@@ -62,6 +62,8 @@ typedef struct tr_state tr_state_t;     /**< state for translation functions */
 typedef struct cell lisp_cell_t;               /**< a lisp object, or "cell" */
 typedef struct lisp lisp_t;             /**< a full lisp environment */
 typedef lisp_cell_t *(*lisp_subr_func)(lisp_t *, lisp_cell_t *); /**< lisp primitive operations */
+typedef lisp_cell_t *(*lisp_vsubr_func)(lisp_t *, size_t, lisp_cell_t **); /**< lisp primitives taking an argument vector, see mk_vsubr() */
+typedef lisp_cell_t *(*lisp_form_func)(lisp_t *, unsigned, lisp_cell_t *, lisp_cell_t *); /**< special forms, see lispmod.h */
 typedef void *(*hash_func)(const char *key, void *val); /**< for hash foreach */
 
 typedef void (*lisp_free_func)(lisp_cell_t *);       /**< function to free a user type*/
@@ -96,6 +98,21 @@ typedef struct {
 	lisp_subr_func p; /**< the actual subroutine to add */
 } lisp_module_subroutines_t; /**< structure for the convenience function lisp_add_module_subroutines */
 
+#define LISP_GC_STATS_TYPES (15) /**< number of cell types counted by the collector*/
+
+typedef struct {
+	size_t collections,       /**< collections completed*/
+	       minor_collections, /**< how many of those were minor collections*/
+	       allocated[LISP_GC_STATS_TYPES], /**< cells allocated, indexed by type*/
+	       freed[LISP_GC_STATS_TYPES],     /**< cells freed, indexed by type*/
+	       bytes_live,        /**< bytes of cells in use after the last collection*/
+	       heap_bytes,        /**< bytes of memory held for cells*/
+	       heap_peak,         /**< largest that "heap_bytes" has been*/
+	       mark_stack_max;    /**< deepest the mark stack has been*/
+	double pause_total,       /**< seconds the program waited on the collector*/
+	       pause_max;         /**< longest single wait, in seconds*/
+} lisp_gc_stats_t; /**< garbage collector statistics, see lisp_gc_stats()*/
+
 /************************** useful functions *********************************/
 
 /* This module mostly has string manipulation functions to make processing
@@ -175,6 +192,20 @@ LIBLISP_API int match(char *pat, char *str);
  *  @return  uint32_t      the resulting hash **/
 LIBLISP_API uint32_t djb2(const char *s, size_t len);
 
+/** @brief   a fast hash that works on up to 48 bytes at a time, it is
+ *           based on wyhash (final version 4) by Wang Yi, which is in
+ *           the public domain, see <https://github.com/wangyi-fudan/wyhash>,
+ *           as built with WYHASH_CONDOM=2 to guard against multiplying
+ *           by zero.
+ *           Unlike djb2 the result depends on a seed, so keys that
+ *           collide cannot be chosen without knowing it. The result also
+ *           depends on the byte order of the machine.
+ *  @param   s      the data to hash
+ *  @param   len    length of s
+ *  @param   seed   any value
+ *  @return  uint64_t      the resulting hash **/
+LIBLISP_API uint64_t wyhash(const void *s, size_t len, uint64_t seed);
+
 /** @brief   get a line text from a file
  *  @param   in    an input file
  *  @return  char* a line of input, without the newline**/
@@ -242,12 +273,14 @@ typedef void  (*hash_free_key_f)(void *);
 typedef void  (*hash_free_val_f)(void *);
 typedef int   (*hash_compare_key_f)(const void *, const void*);
 typedef uint32_t (*hash_f)(const void *);
+typedef uint32_t (*hash_seeded_f)(const void *, uint64_t seed);
 
 /** @brief   create new instance of a hash table, hashes created by
  *           this method will treat keys as string, use strcmp to
- *           compare strings, hash strings with djb2, and will not
+ *           compare strings, hash strings with wyhash, and will not
  *           free either the key or the value when destroyed.
- *  @param   len number of buckets in the table
+ *  @param   len number of buckets in the table, rounded up to a power
+ *               of two
  *  @return  hash_table_t* initialized hash table or NULL**/
 LIBLISP_API hash_table_t *hash_create(size_t len);
 
@@ -258,8 +291,10 @@ LIBLISP_API hash_table_t *hash_copy(hash_table_t *src);
 
 /** @brief   create new instance of a hash table, with custom functions
  *           for freeing the key, the value, comparing keys and hashing
- *           keys.
- *  @param   len number of buckets in the table
+ *           keys. The hash of a key is mixed with the random seed of
+ *           the table before it is used.
+ *  @param   len number of buckets in the table, rounded up to a power
+ *               of two
  *  @param   k   function called to free a key on destruction of hash
  *  @param   v   function called to free a value on destruction of hash
  *  @param   c   function called to compare two keys
@@ -267,6 +302,19 @@ LIBLISP_API hash_table_t *hash_copy(hash_table_t *src);
  *  @return  hash_table_t* initialized hash table or NULL**/
 LIBLISP_API hash_table_t *hash_create_custom(size_t len, hash_free_key_f k, hash_free_val_f v, hash_compare_key_f c, hash_f h);
 
+/** @brief   as hash_create_custom(), but the hash function is given the
+ *           random seed of the table and uses it itself
+ *  @param   len number of buckets in the table, rounded up to a power
+ *               of two
+ *  @param   k   function called to free a key on destruction of hash
+ *  @param   v   function called to free a value on destruction of hash
+ *  @param   c   function called to compare two keys
+ *  @param   h   function called to hash a key with the seed of the
+ *               table, the low bits of the hash select the bucket so
+ *               they must vary as much as the high bits do
+ *  @return  hash_table_t* initialized hash table or NULL**/
+LIBLISP_API hash_table_t *hash_create_custom_seeded(size_t len, hash_free_key_f k, hash_free_val_f v, hash_compare_key_f c, hash_seeded_f h);
+
 
 /** @brief   destroy and invalidate a hash table, this will not attempt to
  *           free the values associated with a key, or the keys, this is
@@ -275,13 +323,23 @@ LIBLISP_API hash_table_t *hash_create_custom(size_t len, hash_free_key_f k, hash
  *  @param   h table to destroy or NULL**/
 LIBLISP_API void hash_destroy(hash_table_t *h);
 
-/** @brief   insert a value into an initialized hash table
+/** @brief   insert a value into an initialized hash table, if the key is
+ *           already present its old key is freed and replaced with the
+ *           new one, as well as its value
  *  @param   ht    table to insert key-value pair into
  *  @param   key   key to associate with a value
  *  @param   val   value to lookup
  *  @return  int   0 on success, < 0 on failure**/
 LIBLISP_API int hash_insert(hash_table_t *ht, char *key, void *val);
 
+/** @brief   remove a key and its value from a table, they are freed
+ *           with the functions given when the table was created. The
+ *           table shrinks when enough has been removed from it.
+ *  @param   ht    table to remove the key from
+ *  @param   key   key to remove
+ *  @return  int   0 if it was removed, < 0 if it was not found**/
+LIBLISP_API int hash_remove(hash_table_t *ht, const char *key);
+
 /** @brief   look up a key in a table
  *  @param   table table to look for value in
  *  @param   key   a key to look up a value with
@@ -332,6 +390,13 @@ LIBLISP_API size_t hash_get_replacements(const hash_table_t *h);
  *  @return size_t number of bins **/
 LIBLISP_API size_t hash_get_number_of_bins(const hash_table_t *h);
 
+/** @brief  A hash is resized a few bins at a time, with its entries moved
+ *          from the old bins during later insertions and removals, this
+ *          gets how many of the old bins are left to move.
+ *  @param  h     hash to query
+ *  @return size_t number of bins left to move, zero if not resizing **/
+LIBLISP_API size_t hash_get_bins_to_move(const hash_table_t *h);
+
 /******************* I/O for reading/writing to strings or files *************/
 
 /* A generic set of functions for reading and writing to files, but also
@@ -680,6 +745,11 @@ LIBLISP_API int  is_sym(lisp_cell_t *x);
  * @return int zero if check fails, non zero if check passes */
 LIBLISP_API int  is_subr(lisp_cell_t *x);
 
+/**@brief  true if 'x' is a language primitive taking an argument vector
+ * @param  x   value to perform check on
+ * @return int zero if check fails, non zero if check passes */
+LIBLISP_API int  is_vsubr(lisp_cell_t *x);
+
 /**@brief  true if 'x' is a ASCII nul delimited string
  * @param  x   value to perform check on
  * @return int zero if check fails, non zero if check passes */
@@ -773,6 +843,20 @@ LIBLISP_API lisp_cell_t *mk_io(lisp_t *l, io_t *x);
  * @return lisp_cell_t* returns a new lisp subroutine object */
 LIBLISP_API lisp_cell_t *mk_subr(lisp_t *l, lisp_subr_func p, const char *fmt, const char *doc);
 
+/**@brief  make a lisp subroutine that is passed its evaluated arguments
+ *         as a vector, "argc" and "argv", instead of as a list. This
+ *         avoids allocating a list for every call. The vector is on an
+ *         argument stack belonging to the interpreter, it is only valid
+ *         until the subroutine returns or evaluates an expression, so it
+ *         is best used for primitives that do not call back into the
+ *         interpreter.
+ * @param  l    lisp environment for error handling and garbage collection
+ * @param  p    function to make into a lisp subroutine
+ * @param  fmt  format of function validation string, as for mk_subr()
+ * @param  doc  documentation string, this can be NULL.
+ * @return lisp_cell_t* returns a new lisp subroutine object */
+LIBLISP_API lisp_cell_t *mk_vsubr(lisp_t *l, lisp_vsubr_func p, const char *fmt, const char *doc);
+
 /**@brief  make a lisp lambda procedure cell.
  * @param  l    lisp environment for error handling and garbage collection
  * @param  args a list of argument names to the function
@@ -860,6 +944,12 @@ LIBLISP_API io_t *get_io(lisp_cell_t *x);
  * @return subr an internal lisp subroutine function*/
 LIBLISP_API lisp_subr_func get_subr(lisp_cell_t *x);
 
+/**@brief  get the function of a subroutine made by mk_vsubr()
+ * @param  x    'x' must be a lisp object of a subroutine type that
+ *              takes an argument vector, see is_vsubr()
+ * @return lisp_vsubr_func an internal lisp subroutine function*/
+LIBLISP_API lisp_vsubr_func get_vsubr(lisp_cell_t *x);
+
 /**@brief  get args to a procedure/f-expr
  * @param  x     'x' must be a lisp object of a lambda or f-expression type
  * @return lisp_cell_t* the arguments list to a lambda or f-expression procedure*/
@@ -870,6 +960,11 @@ LIBLISP_API lisp_cell_t *get_proc_args(lisp_cell_t *x);
  * @return lisp_cell_t* */
 LIBLISP_API lisp_cell_t *get_proc_code(lisp_cell_t *x);
 
+/**@brief  get the byte code a procedure was compiled to
+ * @param  x procedure
+ * @return lisp_cell_t* the compiled code, or NULL if it has none*/
+LIBLISP_API lisp_cell_t *get_proc_bytecode(lisp_cell_t *x);
+
 /**@brief  get procedure/f-expr environment
  * @param  x
  * @return lisp_cell_t* */
@@ -992,7 +1087,9 @@ LIBLISP_API lisp_cell_t *gsym_dowhile(void);
 
 /**@brief  return a new token representing a new type
  * @param  l lisp environment to put the new type in
- * @param  f function to call when freeing type, optional (but free() will be used)
+ * @param  f function to call when freeing type, optional, it should only
+ *           release the resources the cell refers to and not the cell
+ *           itself, which is owned by the garbage collector
  * @param  m function to call when marking type, optional
  * @param  e function to call when comparing two types, optional
  * @param  p function to call when printing type, optional
@@ -1179,6 +1276,17 @@ LIBLISP_API lisp_cell_t *lisp_add_cell(lisp_t *l, const char *sym, lisp_cell_t *
  *                otherwise. You shouldn't do anything with pointer**/
 LIBLISP_API lisp_cell_t *lisp_add_subr(lisp_t *l, const char *name, lisp_subr_func func, const char *fmt, const char *doc);
 
+/** @brief  add a function primitive that takes an argument vector to a
+ *          lisp environment, see lisp_add_subr() and mk_vsubr().
+ *  @param  l     lisp environment to add primitive to
+ *  @param  name  name to call the function primitive by
+ *  @param  func  function primitive
+ *  @param  fmt   format string that is passed to lisp_validate_args (can be NULL)
+ *  @param  doc   documentation string (can be NULL)
+ *  @return lisp_cell_t* pointer to extended environment if successful, NULL
+ *                otherwise. You shouldn't do anything with pointer**/
+LIBLISP_API lisp_cell_t *lisp_add_vsubr(lisp_t *l, const char *name, lisp_vsubr_func func, const char *fmt, const char *doc);
+
 /** @brief  Initialize a lisp environment. By default it will read
  *          from stdin, print to stdout and log errors to stderr.
  *  @return lisp*    A fully initialized lisp environment or NULL**/
@@ -1302,6 +1410,24 @@ LIBLISP_API void lisp_set_line_editor(lisp_t *l, lisp_editor_func ed);
  *  @param  sig signal value, any non zero value halts the lisp environment**/
 LIBLISP_API void lisp_set_signal(lisp_t *l, int sig);
 
+/** @brief  Turn the byte code compiler on or off. When it is on the body of
+ *          a lambda is compiled when it is made and run on a virtual
+ *          machine instead of being evaluated directly, bodies that use
+ *          forms the compiler does not handle (such as "flambda" or
+ *          "compile") are still evaluated directly. It defaults to being
+ *          on, turning it off only affects lambdas made afterwards.
+ *  @param  l  an initialized lisp environment
+ *  @param  on non-zero to turn the compiler on, zero for off**/
+LIBLISP_API void lisp_set_vm(lisp_t *l, int on);
+
+/** @brief  Set how large the stack holding the calls made by byte code can
+ *          grow, in bytes. Compiled procedures calling each other do not
+ *          use the C stack so their recursion depth is limited only by this,
+ *          going over it is a 'recursion-depth-reached error.
+ *  @param  l     an initialized lisp environment
+ *  @param  bytes largest size of the stack**/
+LIBLISP_API void lisp_set_stack_limit(lisp_t *l, size_t bytes);
+
 /** @brief get the input channel in use in a lisp environment
  *  @param  l lisp environment to retrieve input channel from
  *  @return io_t* pointer to input channel or NULL on failure**/
@@ -1380,6 +1506,17 @@ LIBLISP_API int lisp_validate_args(lisp_t *l, const char *msg, unsigned len, con
  *  @return 0 if invalid (or lonjmp if recover is non zero), 1 if valid***/
 LIBLISP_API int lisp_validate_cell(lisp_t *l, lisp_cell_t *x, lisp_cell_t *args, int recover);
 
+/** @brief  validate a vector of arguments to a subroutine, as
+ *          lisp_validate_cell() does for an argument list.
+ *  @param l       lisp environment for error handling
+ *  @param x       subroutine to validate
+ *  @param argc    number of arguments
+ *  @param argv    arguments to validate
+ *  @param recover if non zero this will longjmp to an error handler instead
+ *                 of returning.
+ *  @return 0 if invalid (or lonjmp if recover is non zero), 1 if valid***/
+LIBLISP_API int lisp_validate_argv(lisp_t *l, lisp_cell_t *x, size_t argc, lisp_cell_t **argv, int recover);
+
 /** @brief Given a lisp object it will tell the garbage collector to never collect
  *         that object, ever.
  *  @param x      object to mark as being not collectible */
@@ -1424,6 +1561,71 @@ LIBLISP_API void lisp_gc_on(lisp_t *l);
  * @param l lisp environment to disable garbage collection in*/
 LIBLISP_API void lisp_gc_off(lisp_t *l);
 
+/**@brief Turn generational garbage collection on or off. When it is on,
+ *        cells that survive a collection are promoted to an old
+ *        generation and most collections only trace and free cells
+ *        allocated since the previous one. Old cells are only collected
+ *        once the old generation has doubled in size since the last full
+ *        collection, or by calling lisp_gc_mark_and_sweep(). It defaults
+ *        to being on.
+ * @param l  lisp environment to set the collection mode of
+ * @param on non-zero to turn generational collection on, zero for off*/
+LIBLISP_API void lisp_gc_set_generational(lisp_t *l, int on);
+
+/**@brief Turn incremental garbage collection on or off. When it is on a
+ *        collection is spread out over many allocations, each one doing
+ *        a bounded amount of marking or sweeping (see
+ *        lisp_gc_set_step_budget()) instead of stopping the interpreter
+ *        until it has finished. Marking the roots and the cells written
+ *        to during the collection still happens in one go. It defaults to
+ *        being off.
+ * @param l  lisp environment to set the collection mode of
+ * @param on non-zero to turn incremental collection on, zero for off*/
+LIBLISP_API void lisp_gc_set_incremental(lisp_t *l, int on);
+
+/**@brief Set how far the heap may grow between collections. A collection
+ *        starts once the heap is "percent" percent of its size after the
+ *        previous one, so 200 waits for it to double. It defaults to 200.
+ * @param l       lisp environment to set the pause in
+ * @param percent heap size relative to the last collection, in percent*/
+LIBLISP_API void lisp_gc_set_pause(lisp_t *l, unsigned percent);
+
+/**@brief Set how quickly an incremental collection proceeds relative to
+ *        allocation, each step processes "percent" percent of the cells
+ *        allocated since the previous step. Larger values finish
+ *        collections sooner at the cost of longer steps. It is only used
+ *        when no step budget has been set and defaults to 200.
+ * @param l       lisp environment to set the multiplier in
+ * @param percent work per step relative to allocation, in percent*/
+LIBLISP_API void lisp_gc_set_step_multiplier(lisp_t *l, unsigned percent);
+
+/**@brief Set how much work each step of an incremental collection may do,
+ *        a step stops when either limit is reached. If both are zero,
+ *        the default, the step multiplier decides instead.
+ * @param l     lisp environment to set the budget in
+ * @param cells maximum number of cells to mark or sweep, zero for no limit
+ * @param usecs maximum processor time in microseconds, zero for no limit*/
+LIBLISP_API void lisp_gc_set_step_budget(lisp_t *l, size_t cells, size_t usecs);
+
+/**@brief Get the statistics the garbage collector keeps about itself, they
+ *        are counted from when the environment was created. The type
+ *        indices are the same as those given by the "*cons*", "*string*",
+ *        ... variables within the interpreter. Pause times are in
+ *        processor time and include each step of an incremental collection
+ *        separately.
+ * @param l lisp environment to get the statistics of
+ * @return const lisp_gc_stats_t* statistics, valid until the next
+ *         allocation or collection*/
+LIBLISP_API const lisp_gc_stats_t *lisp_gc_stats(lisp_t *l);
+
+/**@brief Generational collection needs to know about any pointer to a
+ *        lisp cell that is stored into an existing cell. set_car() and
+ *        set_cdr() do this already, but a user defined type with a
+ *        marking function (see new_user_defined_type()) must call this
+ *        with the user defined cell whenever it stores a new cell in it.
+ * @param x the cell that has been written to*/
+LIBLISP_API void lisp_gc_write_barrier(lisp_cell_t *x);
+
 /************************ test environment ***********************************/
 
 /** @brief  A full lisp interpreter environment in a function call. It will
@@ -7,6 +7,7 @@
 
 #include "liblisp.h"
 #include "private.h"
+#include "lispmod.h"
 #include <assert.h>
 #include <setjmp.h>
 #include <signal.h>
@@ -61,6 +62,28 @@ lisp_cell_t *lisp_add_subr(lisp_t * l, const char *name, lisp_subr_func func, co
 	return lisp_extend_top(l, lisp_intern(l, lisp_strdup(l, name)), mk_subr(l, func, fmt, doc));
 }
 
+lisp_cell_t *lisp_add_vsubr(lisp_t * l, const char *name, lisp_vsubr_func func, const char *fmt, const char *doc) {
+	assert(l && name && func);	/*fmt and doc are optional */
+	return lisp_extend_top(l, lisp_intern(l, lisp_strdup(l, name)), mk_vsubr(l, func, fmt, doc));
+}
+
+int lisp_add_special_form(lisp_t *l, const char *name, lisp_form_func func) {
+	assert(l && name && func);
+	lisp_cell_t *sym = lisp_intern(l, lisp_strdup(l, name));
+	if (sym->uncollectable || (sym->form == FORM_NONE && l->forms_used >= MAX_FORMS))
+		return -1; /* the built in forms cannot be replaced */
+	if (sym->form == FORM_NONE)
+		sym->form = l->forms_used++;
+	l->forms[sym->form] = func;
+	lisp_extend_top(l, sym, sym);
+	return 0;
+}
+
+lisp_cell_t *lisp_eval_form(lisp_t *l, unsigned depth, lisp_cell_t *exp, lisp_cell_t *env) {
+	assert(l && exp && env);
+	return eval(l, depth, exp, env);
+}
+
 lisp_cell_t *lisp_get_all_symbols(lisp_t * l) {
 	assert(l);
 	return l->all_symbols;
@@ -78,15 +101,14 @@ void lisp_destroy(lisp_t * l) {
 	l->gc_off = 0;
 	if (l->gc_stack)
 		lisp_gc_sweep_only(l), free(l->gc_stack);
+	free(l->args);
 	if (lisp_get_logging(l))
 		io_close(lisp_get_logging(l));
 	if (lisp_get_output(l))
 		io_close(lisp_get_output(l));
 	if (lisp_get_input(l))
 		io_close(lisp_get_input(l));
-	free(l->input);
-	free(l->output);
-	free(l->logging);
+	lisp_gc_release_all(l);
 	free(l);
 }
 
@@ -119,12 +141,15 @@ int lisp_print(lisp_t * l, lisp_cell_t * ob) {
 lisp_cell_t *lisp_eval(lisp_t * l, lisp_cell_t * exp) {
 	assert(l && exp);
 	int restore_used, r;
+	size_t args_used = l->args_used, gc_stack_used = l->gc_stack_used;
 	jmp_buf restore;
 	if (l->recover_init) {
 		memcpy(restore, l->recover, sizeof(jmp_buf));
 		restore_used = 1;
 	}
 	if ((r = setjmp(l->recover))) {
+		l->args_used = args_used;
+		l->gc_stack_used = gc_stack_used;
 		LISP_RECOVER_RESTORE(restore_used, l, restore);
 		return r > 0 ? l->error : NULL;
 	}
@@ -140,6 +165,7 @@ lisp_cell_t *lisp_eval_string(lisp_t * l, const char *evalme) {
 	io_t *in = NULL;
 	lisp_cell_t *ret;
 	volatile int restore_used = 0, r;
+	size_t args_used = l->args_used, gc_stack_used = l->gc_stack_used;
 	jmp_buf restore;
 	if (!(in = io_sin(evalme, strlen(evalme))))
 		return NULL;
@@ -148,6 +174,8 @@ lisp_cell_t *lisp_eval_string(lisp_t * l, const char *evalme) {
 		restore_used = 1;
 	}
 	if ((r = setjmp(l->recover))) {
+		l->args_used = args_used;
+		l->gc_stack_used = gc_stack_used;
 		io_close(in);
 		LISP_RECOVER_RESTORE(restore_used, l, restore);
 		return r > 0 ? l->error : NULL;
@@ -32,6 +32,30 @@ int lisp_mutex_trylock(lisp_mutex_t *m);
 int lisp_mutex_unlock(lisp_mutex_t *m);
 /********/
 
+/* special forms */
+
+/**@brief Add a special form, a form whose arguments are passed to "func"
+ *        unevaluated, along with the depth and environment it is
+ *        evaluated in, instead of being evaluated first. Like the built
+ *        in special forms the symbol is bound to itself and cannot be
+ *        shadowed by a variable.
+ * @param  l    lisp environment to add the special form to
+ * @param  name name of the special form, which must not be a built in one
+ * @param  func function implementing the special form, adding a form that
+ *              already exists replaces its function
+ * @return int  zero on success, negative if there is no room for it or the
+ *              name is that of a built in form */
+LIBLISP_API int lisp_add_special_form(lisp_t *l, const char *name, lisp_form_func func);
+
+/**@brief Evaluate an expression within a special form, this is only valid
+ *        whilst the special form is being evaluated.
+ * @param  l     lisp environment passed to the special form
+ * @param  depth depth passed to the special form
+ * @param  exp   expression to evaluate
+ * @param  env   environment passed to the special form, or one extending it
+ * @return lisp_cell_t* the result, errors are thrown as if by eval*/
+LIBLISP_API lisp_cell_t *lisp_eval_form(lisp_t *l, unsigned depth, lisp_cell_t *exp, lisp_cell_t *env);
+
 #ifdef __unix__
 typedef void* dl_handle_t;
 
@@ -169,7 +169,7 @@ static void dlclose_atexit(void) {
 
 static void ud_dl_free(lisp_cell_t *f) {
       /*DL_CLOSE(get_user(f)); This is handled atexit instead*/
-        free(f);
+        UNUSED(f);
 }
 
 static int ud_dl_print(io_t *o, unsigned depth, lisp_cell_t *f) {
@@ -137,12 +137,13 @@ ISX_LIST /*defines lisp subroutines for checking whether a string only contains
 #undef X
 
 #define SUBROUTINE_XLIST\
-	X("crc",        subr_crc,        "Z",   "CRC-32 of a string")\
-	X("hash",       subr_hash,       "Z",   "hash a string")\
+	X("crc",        subr_crc,        "Z",   "CRC-32 (as used by zlib) of a string")\
+	X("hash",       subr_hash,       "Z",   "djb2 hash of a string, it is the same on every run unlike the hashes tables use")\
 	X("date",       subr_date,       "",    "return a list representing the date (GMT) (not thread safe)")\
 	X("documentation",  subr_doc_string, "x",   "return the documentation string from a procedure")\
 	X("errno",      subr_errno,      "",    "return the current errno")\
-	X("gc",         subr_gc,         "",    "force the collection of garbage")\
+	X("gc",         subr_gc,         NULL,  "force the collection of garbage, or configure the collector with ('generational bool), ('incremental bool) or ('budget cells microseconds), ('pause percent) or ('step-multiplier percent)")\
+	X("gc-stats",   subr_gc_stats,   "",    "return an a-list of garbage collector statistics, cell counts are keyed by type")\
 	X("ilog2",      subr_ilog2,      "d",   "compute the binary logarithm of an integer")\
 	X("ipow",       subr_ipow,       "d d", "compute the integer exponentiation of two numbers")\
 	X("set-locale", subr_setlocale,  "d Z", "set the locale, this affects global state!")\
@@ -354,9 +355,75 @@ static lisp_cell_t *subr_system(lisp_t * l, lisp_cell_t * args)
 
 static lisp_cell_t *subr_gc(lisp_t * l, lisp_cell_t * args)
 {
+	if (lisp_check_length(args, 0)) {
+		lisp_gc_mark_and_sweep(l);
+		return gsym_tee();
+	}
+	if (!is_sym(car(args)))
+		goto fail;
+	if (lisp_check_length(args, 2) && !strcmp(get_sym(car(args)), "generational")) {
+		lisp_gc_set_generational(l, !is_nil(CADR(args)));
+		return gsym_tee();
+	}
+	if (lisp_check_length(args, 2) && !strcmp(get_sym(car(args)), "incremental")) {
+		lisp_gc_set_incremental(l, !is_nil(CADR(args)));
+		return gsym_tee();
+	}
+	if (lisp_check_length(args, 2) && !strcmp(get_sym(car(args)), "pause")
+			&& is_int(CADR(args)) && get_int(CADR(args)) >= 0) {
+		lisp_gc_set_pause(l, get_int(CADR(args)));
+		return gsym_tee();
+	}
+	if (lisp_check_length(args, 2) && !strcmp(get_sym(car(args)), "step-multiplier")
+			&& is_int(CADR(args)) && get_int(CADR(args)) >= 0) {
+		lisp_gc_set_step_multiplier(l, get_int(CADR(args)));
+		return gsym_tee();
+	}
+	if (lisp_check_length(args, 3) && !strcmp(get_sym(car(args)), "budget")
+			&& is_int(CADR(args)) && is_int(CADDR(args))
+			&& get_int(CADR(args)) >= 0 && get_int(CADDR(args)) >= 0) {
+		lisp_gc_set_step_budget(l, get_int(CADR(args)), get_int(CADDR(args)));
+		return gsym_tee();
+	}
+fail:
+	LISP_RECOVER(l, "\"expected () or (symbol any...)\"\n '%S", args);
+	return gsym_error();
+}
+
+/**@brief cons a symbol and a value on to an association list*/
+static lisp_cell_t *acons(lisp_t *l, char *name, lisp_cell_t *val, lisp_cell_t *alist)
+{
+	char *s = lisp_strdup(l, name);
+	lisp_cell_t *sym = lisp_intern(l, s);
+	if (get_sym(sym) != s) /* already interned */
+		free(s);
+	return cons(l, cons(l, sym, val), alist);
+}
+
+/**@brief turn a per type count into an a-list keyed by type*/
+static lisp_cell_t *gc_type_counts(lisp_t *l, const size_t *counts)
+{
+	lisp_cell_t *r = gsym_nil();
+	for (size_t i = LISP_GC_STATS_TYPES; i-- > 1;)
+		r = cons(l, cons(l, mk_int(l, i), mk_int(l, counts[i])), r);
+	return r;
+}
+
+static lisp_cell_t *subr_gc_stats(lisp_t * l, lisp_cell_t * args)
+{
+	const lisp_gc_stats_t *s = lisp_gc_stats(l);
+	lisp_cell_t *r = gsym_nil();
 	UNUSED(args);
-	lisp_gc_mark_and_sweep(l);
-	return gsym_tee();
+	r = acons(l, "freed",             gc_type_counts(l, s->freed), r);
+	r = acons(l, "allocated",         gc_type_counts(l, s->allocated), r);
+	r = acons(l, "mark-stack-max",    mk_int(l, s->mark_stack_max), r);
+	r = acons(l, "pause-max",         mk_float(l, s->pause_max), r);
+	r = acons(l, "pause-total",       mk_float(l, s->pause_total), r);
+	r = acons(l, "heap-peak",         mk_int(l, s->heap_peak), r);
+	r = acons(l, "heap-bytes",        mk_int(l, s->heap_bytes), r);
+	r = acons(l, "bytes-live",        mk_int(l, s->bytes_live), r);
+	r = acons(l, "minor-collections", mk_int(l, s->minor_collections), r);
+	return acons(l, "collections",    mk_int(l, s->collections), r);
 }
 
 static lisp_cell_t *subr_ilog2(lisp_t * l, lisp_cell_t * args)
@@ -475,6 +542,8 @@ static lisp_cell_t *subr_crc(lisp_t * l, lisp_cell_t * args)
 	return mk_int(l, c);
 }
 
+/* this does not use the hash function of the hash tables, which is seeded
+ * randomly, the result of this should be stored and compared across runs */
 static lisp_cell_t *subr_hash(lisp_t * l, lisp_cell_t * args)
 {
 	return mk_int(l, djb2(get_str(car(args)), get_length(car(args))));
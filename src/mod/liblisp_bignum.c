@@ -40,7 +40,6 @@ static int ud_bignum = 0;
 static void ud_bignum_free(lisp_cell_t * f)
 {
 	bignum_destroy(get_user(f));
-	free(f);
 }
 
 static int ud_bignum_print(io_t * o, unsigned depth, lisp_cell_t * f)
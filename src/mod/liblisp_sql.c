@@ -38,7 +38,6 @@ static void ud_sql_free(lisp_cell_t * f)
 {
 	if (!is_closed(f))
 		sqlite3_close(get_user(f));
-	free(f);
 }
 
 static int ud_sql_print(io_t * o, unsigned depth, lisp_cell_t * f)
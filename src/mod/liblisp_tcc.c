@@ -37,7 +37,6 @@ static int ud_tcc = 0;
 static void ud_tcc_free(lisp_cell_t * f)
 {
 	tcc_delete(get_user(f));
-	free(f);
 }
 
 static int ud_tcc_print(io_t * o, unsigned depth, lisp_cell_t * f)
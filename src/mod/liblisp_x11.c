@@ -74,7 +74,6 @@ static void ud_x11_free(lisp_cell_t * f)
 {
 	if (!is_closed(f))
 		close_window((Window) get_user(f));
-	free(f);
 }
 
 static int ud_x11_print(io_t * o, unsigned depth, lisp_cell_t * f)
@@ -89,29 +89,27 @@ int lisp_printf(lisp_t *l, io_t *o, unsigned depth, char *fmt, ...) {
 
 static int print_hash(lisp_t *l, io_t *o, unsigned depth, hash_table_t *ht) {
 	int ret = 0, m = 0;
-	size_t i;
+	size_t i = 0;
 	hash_entry_t *cur;
 	if ((ret = lisp_printf(l, o, depth, "{")) < 0)
 		return -1;
-	for (i = 0; i < ht->len; i++)
-		if (ht->table[i])
-		/**@warning messy hash stuff*/
-		for (cur = ht->table[i]; cur; cur = cur->next) {
-			int n = 0;
-			io_putc(' ', o);
-			if (is_cons(cur->val) && is_sym(car(cur->val)))
-				m = lisp_printf(l, o, depth, "%S", car(cur->val));
-			else
-				m = print_escaped_string(l, o, depth, cur->key);
+	/**@warning messy hash stuff*/
+	while ((cur = hash_iterate(ht, &i))) {
+		int n = 0;
+		io_putc(' ', o);
+		if (is_cons(cur->val) && (is_sym(car(cur->val)) || get_hash_test(ht) != HASH_STRING))
+			m = lisp_printf(l, o, depth, "%S", car(cur->val));
+		else
+			m = print_escaped_string(l, o, depth, cur->key);
 
-			if (is_cons(cur->val))
-				n = lisp_printf(l, o, depth, "%t %S", cdr(cur->val));
-			else
-				n = lisp_printf(l, o, depth, "%t %S", cur->val);
-			if (m < 0 || n < 0)
-				return -1;
-			ret += m + n;
-		}
+		if (is_cons(cur->val))
+			n = lisp_printf(l, o, depth, "%t %S", cdr(cur->val));
+		else
+			n = lisp_printf(l, o, depth, "%t %S", cur->val);
+		if (m < 0 || n < 0)
+			return -1;
+		ret += m + n;
+	}
 	if ((m = io_puts(" }", o)) < 0)
 		return -1;
 	return ret + m;
@@ -195,14 +193,14 @@ finish:
 }
 
 int printer(lisp_t *l, io_t *o, lisp_cell_t *op, unsigned depth) {
-	lisp_cell_t *tmp;
+	lisp_cell_t *tmp, *start;
 	if (!op)
 		return EOF;
 	if (l && depth > MAX_RECURSION_DEPTH) {
 		lisp_log_error(l, "%r'print-depth-exceeded %d%t", (intptr_t) depth);
 		return -1;
 	}
-	switch (op->type) {
+	switch (TYPE(op)) {
 	case INTEGER:
 		lisp_printf(l, o, depth, "%m%d", get_int(op));
 		break;
@@ -212,22 +210,26 @@ int printer(lisp_t *l, io_t *o, lisp_cell_t *op, unsigned depth) {
 	case CONS:
 		if (depth && o->pretty)
 			lisp_printf(l, o, depth, "\n%@ ");
-		if (op->mark) {
-			op->mark = 0;
+		/* a list that contains itself is found by flagging each list
+		 * while it is printed, a list that loops through its cdr by
+		 * Floyd's cycle detection, "tmp" moves at half speed */
+		if (lisp_gc_printing(op)) {
 			lisp_printf(l, o, depth, "%g<recurse:%d>%t", (intptr_t)op);
 			return 0;
 		}
-		tmp = op;
-		op->mark = 1;
+		lisp_gc_set_printing(op, 1);
+		start = tmp = op;
 		io_putc('(', o);
-		for (;;) {
+		for (unsigned n = 0;; n++) {
 			printer(l, o, car(op), depth + 1);
 			if (is_nil(cdr(op))) {
 				io_putc(')', o);
 				break;
 			}
 			op = cdr(op);
-			if (op->mark) {
+			if (n & 1)
+				tmp = cdr(tmp);
+			if (op == tmp || (is_cons(op) && lisp_gc_printing(op))) {
 				lisp_printf(l, o, depth, "%g <recurse:%d>%t)", (intptr_t)op);
 				break;
 			}
@@ -237,7 +239,7 @@ int printer(lisp_t *l, io_t *o, lisp_cell_t *op, unsigned depth) {
 			}
 			io_putc(' ', o);
 		}
-		tmp->mark = 0;
+		lisp_gc_set_printing(start, 0);
 		break;
 	case SYMBOL:
 		if (is_nil(op)) lisp_printf(l, o, depth, "%rnil");
@@ -246,6 +248,18 @@ int printer(lisp_t *l, io_t *o, lisp_cell_t *op, unsigned depth) {
 	case STRING:
 		print_escaped_string(l, o, depth, get_str(op));
 		break;
+	case LEXICAL: /* prints as the symbol it was resolved from */
+		printer(l, o, op->p[0].v, depth);
+		break;
+	case CODE:
+		lisp_printf(l, o, depth, "%B<code:%d>", get_int(op));
+		break;
+	case FRAME: /* prints as the association list it stands in for */
+		io_putc('(', o);
+		for (size_t i = 0; i < get_frame_count(op); i++)
+			lisp_printf(l, o, depth + 1, "(%S . %S) ", get_frame_symbol(op, i), get_frame_value(op, i));
+		lisp_printf(l, o, depth, ". %S)", get_frame_parent(op));
+		break;
 	case SUBR:
 		lisp_printf(l, o, depth, "%B<subroutine:%d>", get_int(op));
 		break;
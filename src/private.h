@@ -22,19 +22,49 @@ extern "C" {
 #define DEFAULT_LEN       (256)   /**< just an arbitrary number*/
 #define LARGE_DEFAULT_LEN (4096)  /**< just another arbitrary number*/
 #define MAX_USER_TYPES    (256)   /**< max number of user defined types*/
-#define COLLECTION_POINT  (1<<20) /**< run gc after this many allocs*/
+#define MAX_FORMS         (64)    /**< max number of special forms, see "form" in a cell*/
+#define GC_HEAP_MINIMUM   (1<<22) /**< heap size in bytes that triggers the first gc*/
+#define GC_PAUSE          (200)   /**< default heap growth between gc, percent*/
+#define GC_STEP_MULTIPLIER (200)  /**< default gc work per cell allocated, percent*/
 #define BITS_IN_LENGTH    (32)    /**< number of bits in a length field*/
 #define MAX_RECURSION_DEPTH (4096) /**< maximum recursion depth*/
+#define STACK_LIMIT       (1<<26) /**< default bytes the stack of temporaries can grow to*/
+#define GC_PAGE_SIZE      (1<<16) /**< heap page size, must be a power of two*/
+#define GC_CHUNK_PAGES    (16)    /**< heap pages allocated from the system at once*/
+#define GC_MARK_STACK_SIZE (4096) /**< maximum depth of the mark stack*/
+#define GC_SCAN_SPINE     (256)   /**< list cells scanned before yielding*/
+#define GC_STEP_SIZE      (1<<15) /**< bytes allocated between incremental steps*/
+#define GC_SIZE_CLASSES   (7)     /**< number of cell size classes*/
+#define GC_CONS_CLASS     (6)     /**< the size class of cons cells, which have no header*/
+#define GC_MAX_FIELDS     (16)    /**< most data fields a cell can have*/
+#define FRAME_HEADER      (3)     /**< fields in a frame before its values*/
+#define SUBR_HEADER       (5)     /**< fields in a subroutine before its type masks*/
+#define GC_BITMAP_WORDS   (GC_PAGE_SIZE / (2 * sizeof(cell_data_t)) / 64) /**< words in a page bitmap*/
 
 /**@warning the following list must be kept in sync with the
  * gsym_X functions defined in there liblisp.h header (such as gsym_nil,
  * gsym_tee or gsym_error). */
 #define CELL_XLIST /**< list of all special cells for initializer*/ \
-	X(nil,     "nil")     X(tee,     "t")      X(quote,   "quote")\
-	X(iif,     "if")      X(lambda,  "lambda") X(flambda, "flambda")\
-	X(define,  "define")  X(setq,    "setq")   X(progn,   "progn")\
-	X(cond,    "cond")    X(error,   "error")  X(let,     "let")\
-       	X(compile, "compile") X(macro,   "macro")  X(dowhile, "while")\
+	X(nil,     "nil",     FORM_NONE)    X(tee,     "t",       FORM_NONE)\
+	X(quote,   "quote",   FORM_QUOTE)   X(iif,     "if",      FORM_IF)\
+	X(lambda,  "lambda",  FORM_LAMBDA)  X(flambda, "flambda", FORM_FLAMBDA)\
+	X(define,  "define",  FORM_DEFINE)  X(setq,    "setq",    FORM_SETQ)\
+	X(progn,   "progn",   FORM_PROGN)   X(cond,    "cond",    FORM_COND)\
+	X(error,   "error",   FORM_NONE)    X(let,     "let",     FORM_LET)\
+	X(compile, "compile", FORM_COMPILE) X(macro,   "macro",   FORM_MACRO)\
+	X(dowhile, "while",   FORM_WHILE)
+
+/**@brief The symbol of a special form is tagged with which one it is, so
+ * eval() can dispatch on the tag instead of comparing the symbol against
+ * each of them. Forms added with lisp_add_special_form() are numbered
+ * from FORM_USER onwards.*/
+typedef enum {
+	FORM_NONE,    /**< not a special form*/
+	FORM_QUOTE,   FORM_IF,   FORM_LAMBDA, FORM_FLAMBDA, FORM_DEFINE,
+	FORM_SETQ,    FORM_PROGN, FORM_COND,  FORM_LET,     FORM_COMPILE,
+	FORM_MACRO,   FORM_WHILE,
+	FORM_USER     /**< the first form added by a module*/
+} form_e;
 
 /**@brief This restores a jmp_buf stored in lisp environment if it
  *	has been copied out to make way for another jmp_buf.
@@ -60,7 +90,10 @@ typedef enum {
 	FPROC,   /**< F-Expression*/
 /*	MACRO,   // Macro */
 	FLOAT,   /**< Floating point number; could be float or double*/
-	USERDEF  /**< User defined types*/
+	USERDEF, /**< User defined types*/
+	LEXICAL, /**< lexical address of a variable*/
+	FRAME,   /**< arguments of a procedure call*/
+	CODE     /**< compiled body of a procedure, the last type (see LISP_GC_STATS_TYPES)*/
 	/**@todo CLOSURE, MACRO (replaces FPROC), VECTORs (array of same type, strings really
 	 * should be a vector of chars). */
 } lisp_type;     /**< A lisp object*/
@@ -70,12 +103,16 @@ typedef union { /**< ideally we would use void* for everything*/
 	lisp_float_t f;    /**< if lisp_float_t is double it could be bigger than *v */
 	lisp_subr_func prim;   /**< function pointers are not guaranteed
 	                                              to fit into a void**/
+	lisp_vsubr_func vprim; /**< subroutine taking an argument vector*/
+	uintptr_t mask;        /**< argument types a subroutine accepts*/
 } cell_data_t; /**< a union of all the different C datatypes used*/
 
 /**@brief A tagged object representing all possible lisp data types.
  *
- * It is possible to further reduce the memory usage if you are willing to
- * sacrifice portability.
+ * Integers that fit are not allocated at all, they are kept in the
+ * pointer to the cell instead, see IS_FIXNUM. Cons cells are just their
+ * two data fields, with no header, and are told apart by a tag in the
+ * pointer to them, see IS_CONS_PTR.
  *
  * See:
  * <http://www.more-magic.net/posts/internals-data-representation.html>
@@ -87,39 +124,79 @@ typedef union { /**< ideally we would use void* for everything*/
  * <http://c-faq.com/struct/structhack.html> **/
 struct cell {
 	/**@todo look at optimizing these fields, also add weak references*/
-	unsigned type:   4,        /**< Type of the lisp object*/
-		mark:    1,        /**< mark for garbage collection*/
+	unsigned type:   5,        /**< Type of the lisp object*/
 		uncollectable: 1,  /**< do not free object?*/
 		close:   1,        /**< object closed/invalid?*/
-		used:    1; /**< object is in use by something outside lisp interpreter*/
+		used:    1, /**< object is in use by something outside lisp interpreter*/
+		compiled: 1, /**< procedure made by "compile", can it be inlined?*/
+		pure:    1,  /**< subroutine without side effects, can it be folded?*/
+		argv:    1,  /**< subroutine takes an argument vector, not a list?*/
+		form:    6,  /**< special form a symbol names, a form_e*/
+		hashed:  1;  /**< has the hash of a symbol or string been kept?*/
+	uint32_t hash;       /**< hash of a symbol or string, see get_key_hash()*/
 	cell_data_t p[1]; /**< uses the "struct hack",
 	                     c99 does not quite work here*/
 } /*__attribute__((packed)) <- saves a bit of space */;
 
+/* A "fixnum" is an integer stored in a cell pointer shifted left by one
+ * with the lowest bit set, cells are always aligned so no real cell has
+ * this bit set. A fixnum must never be dereferenced, TYPE() gets the type
+ * of any cell. Integers outside of the range of a fixnum are allocated
+ * as usual.
+ *
+ * A cons cell is a pair of data fields in a page of its own size class
+ * (16 bytes on most machines), pointers to it have CONS_TAG added. The
+ * flags other cells keep in their header are kept in bitmaps in the page
+ * for a cons. Anything that works on any cell uses CELL_FIELDS() to get
+ * at its data fields. */
+#define IS_FIXNUM(X)  ((uintptr_t)(X) & 1) /**< is a cell pointer an integer?*/
+#define MK_FIXNUM(D)  ((lisp_cell_t *)((uintptr_t)(D) * 2 + 1)) /**< make a fixnum*/
+#define GET_FIXNUM(X) (((intptr_t)(X) - 1) / 2) /**< get the value of a fixnum*/
+#define FIXNUM_MIN    (INTPTR_MIN / 2) /**< smallest integer that is a fixnum*/
+#define FIXNUM_MAX    (INTPTR_MAX / 2) /**< largest integer that is a fixnum*/
+#define CONS_TAG      (2) /**< added to the address of a cons cell*/
+#define IS_CONS_PTR(X) (((uintptr_t)(X) & 3) == CONS_TAG) /**< is a cell pointer a cons?*/
+#define HAS_HEADER(X) (!((uintptr_t)(X) & 3)) /**< can the header of a cell be read?*/
+#define CONS_FIELDS(X) ((cell_data_t *)((uintptr_t)(X) - CONS_TAG)) /**< fields of a cons*/
+#define CELL_FIELDS(X) (IS_CONS_PTR(X) ? CONS_FIELDS(X) : (X)->p) /**< fields of any cell*/
+#define TYPE(X)       (IS_FIXNUM(X) ? INTEGER : IS_CONS_PTR(X) ? CONS : (lisp_type)(X)->type) /**< type of any cell*/
+
 /** @brief This describes an entry in a hash table, which is an
  *	 implementation detail of the hash, so should not be
- *	 counted upon. It represents a node in a chained hash
- *	 table */
-typedef struct hash_entry {      /**< linked list of entries in a bin*/
+ *	 counted upon. Entries are stored in one array with open
+ *	 addressing, an entry is kept as close to the bin its hash
+ *	 selects as possible with Robin Hood probing. */
+typedef struct hash_entry {
 	char *key;              /**< ASCII nul delimited string*/
 	void *val;              /**< arbitrary value*/
-	struct hash_entry *next; /**< next item in list*/
+	uint32_t hash,          /**< hash of the key, saves rehashing and comparisons*/
+		 distance;      /**< distance of the entry from its bin plus one*/
 } hash_entry_t;
 
+/** @brief The bins of a hash table, a table has two of these while it is
+ *	 being resized. */
+typedef struct {
+	hash_entry_t *table; /**< entries, indexed by bin*/
+	uint8_t *meta;       /**< per bin, zero if empty or the distance of the entry, at most UINT8_MAX*/
+	size_t len;          /**< number of 'bins'*/
+} hash_bins_t;
+
 struct hash_table {	        /**< a hash table*/
-	hash_entry_t **table; /**< table of linked lists*/
-	size_t len,  /**< number of 'bins' in the hash table*/
+	hash_bins_t bins, /**< bins new entries go into*/
+		    old;  /**< bins being moved into "bins" a few at a time when resizing*/
+	size_t moved,        /**< number of bins in "old" moved so far*/
 	       collisions,   /**< number of collisions */
 	       replacements, /**< number of entries replaced*/
-	       used          /**< number of bins used*/;
+	       used          /**< number of entries, in either set of bins*/;
+	uint64_t seed;       /**< passed to the hash function, it differs for each table*/
 	/*state used for the foreach loop*/
 	unsigned foreach :1;  /**< if true, we are in a foreach loop*/
 	size_t foreach_index; /**< index into foreach loop*/
-	void *foreach_cur;    /**< current entry in foreach loop*/
 	hash_free_key_f free_key; /**< called to free a key */
 	hash_free_val_f free_val; /**< called to free a value */
 	hash_compare_key_f compare; /**< called to compare a key */
-	hash_f hash; /**< called to hash a key*/
+	hash_seeded_f hash; /**< called to hash a key with "seed"*/
+	hash_f unseeded;    /**< hash function given to hash_create_custom(), if any*/
 };
 
 /** @brief A structure that is used to wrap up the I/O operations
@@ -156,11 +233,69 @@ struct tr_state {
 		previous_char; /**< previous translation char, for squeeze*/
 };
 
-/** @brief Type used to form linked list of all allocations */
-typedef struct gc_list {
-	lisp_cell_t *ref; /**< reference to cell for the garbage collector to act on*/
-	struct gc_list *next; /**< next in list*/
-} gc_list_t;
+/** @brief A block of memory that heap pages are cut from, see
+ *	 gc_chunk_new(). It is freed once none of its pages are used.*/
+typedef struct gc_chunk {
+	struct gc_chunk *next; /**< next chunk in the heap*/
+	void *raw;             /**< pointer to free() the chunk with*/
+	size_t pages,          /**< number of pages cut from it*/
+	       used;           /**< number of those in use by a size class*/
+} gc_chunk_t;
+
+/** @brief A page of the heap, cells of a single size class are allocated
+ *	 out of it. Pages are aligned on GC_PAGE_SIZE so the page a cell
+ *	 belongs to can be found by masking the cells address. Whether a
+ *	 slot is allocated and whether it has been marked is kept in
+ *	 bitmaps beside the cells, so the sweeper can find dead cells a
+ *	 word at a time without touching the cells that are live. */
+typedef struct gc_page {
+	struct gc_page *next; /**< next page in this size class*/
+	gc_chunk_t *chunk;    /**< chunk the page was cut from*/
+	char *base;           /**< first slot in this page*/
+	lisp_cell_t *free;    /**< free slots, threaded through their first data field*/
+	unsigned epoch;       /**< the value of "gc_epoch" when last swept*/
+	int has_dirty;        /**< any bits set in "dirty"?*/
+	int cons;             /**< slots are headerless cons cells?*/
+	size_t bump,          /**< slots from here on have never been used*/
+	       live,          /**< number of allocated slots*/
+	       slot_size,     /**< size in bytes of a slot*/
+	       slots;         /**< number of slots in this page*/
+	uint64_t alloc[GC_BITMAP_WORDS], /**< slot is allocated*/
+		 mark[GC_BITMAP_WORDS],  /**< slot has been marked*/
+		 old[GC_BITMAP_WORDS],   /**< slot survived a collection*/
+		 dirty[GC_BITMAP_WORDS], /**< old or marked slot written to*/
+		 used[GC_BITMAP_WORDS],  /**< cons is in use outside of the interpreter*/
+		 resolved[GC_BITMAP_WORDS], /**< cons is a lambda body with its variables resolved*/
+		 printing[GC_BITMAP_WORDS]; /**< cons is a list being printed*/
+} gc_page_t;
+
+/** @brief How the keys of a hash table made by the interpreter are
+ *	 compared, see hash_create_test(). Keys of the string tables are
+ *	 the text of symbols and strings, keys of the others are cells.*/
+typedef enum {
+	HASH_STRING, /**< symbols and strings by their text, the default*/
+	HASH_EQ,     /**< any object by its identity*/
+	HASH_EQL,    /**< numbers by their type and value, otherwise as HASH_EQ*/
+	HASH_EQUAL   /**< strings by their text and conses by their contents,
+		      *   otherwise as HASH_EQL*/
+} hash_test_e;
+
+/** @brief What the collector is doing, an incremental collection moves
+ *	 through these phases a step at a time */
+typedef enum {
+	GC_IDLE,  /**< no collection is in progress*/
+	GC_MARK,  /**< marking, grey cells are on the mark stack*/
+	GC_SWEEP  /**< sweeping pages from before the current epoch*/
+} gc_phase_e;
+
+/** @brief A size class of the allocator, there is one for each of the
+ *	 fixed cell shapes (1, 2, 4, 5, 8 and 16 data fields) and one for
+ *	 cons cells. */
+typedef struct {
+	size_t slot_size;   /**< size in bytes of a slot in this class*/
+	gc_page_t *pages,   /**< all pages allocated for this class*/
+		  *cursor;  /**< page to try to allocate from next*/
+} gc_size_class_t;
 
 /** @brief functions the interpreter uses for user defined types */
 typedef struct {
@@ -177,7 +312,7 @@ typedef struct {
  *	 to run a complete lisp environment. */
 struct lisp {
 	jmp_buf recover; /**< longjmp when there is an error */
-#define X(CNAME, LNAME) * CNAME,
+#define X(CNAME, LNAME, FORM) * CNAME,
 	lisp_cell_t CELL_XLIST Unused; /**< list of special forms/symbols*/
 #undef X
 	lisp_cell_t *all_symbols, /**< all intern'ed symbols*/
@@ -188,18 +323,42 @@ struct lisp {
 		*logging,     /**< interpreter logging/error stream*/
 		*cur_env,     /**< current interpreter depth*/
 		*empty_docstr,/**< empty doc string */
-		**gc_stack;   /**< garbage collection stack for working items*/
-	gc_list_t *gc_head;   /**< linked list of all allocated objects*/
+		**gc_stack,   /**< garbage collection stack for working items*/
+		**args;       /**< arguments to subroutines taking a vector*/
+	gc_size_class_t gc_classes[GC_SIZE_CLASSES]; /**< heap pages by cell size*/
+	gc_chunk_t *gc_chunks;  /**< memory the heap pages are cut from*/
+	gc_page_t *gc_spare;    /**< pages not in use by any size class*/
+	lisp_gc_stats_t gc_stats; /**< collector statistics*/
+	lisp_cell_t *gc_mark_stack[GC_MARK_STACK_SIZE]; /**< marked cells yet to be scanned*/
+	size_t gc_mark_used, /**< cells on the mark stack*/
+	       gc_live,      /**< cells alive after the last collection*/
+	       gc_major_live,/**< cells alive after the last major collection*/
+	       gc_bytes,     /**< bytes of cells allocated in the heap*/
+	       gc_threshold, /**< collect when "gc_bytes" reaches this*/
+	       gc_pause,     /**< heap growth allowed between collections, percent*/
+	       gc_stepmul,   /**< cells processed per step, percent of allocation*/
+	       gc_budget_cells, /**< cells to process per step, 0 is unlimited*/
+	       gc_budget_usecs, /**< time allowed per step, 0 is unlimited*/
+	       gc_sweep_class;  /**< size class being swept*/
+	gc_page_t **gc_sweep_at;/**< link to the next page to sweep*/
+	gc_phase_e gc_phase;    /**< phase of the current collection*/
+	unsigned gc_epoch;      /**< number of collections that started sweeping*/
+	unsigned binding_version; /**< changed when a binding could be shadowed*/
+	uint64_t hash_seed;     /**< seed of the hash tables the interpreter makes*/
 	char *token    /**< one token of put back for parser*/,
 		*buf   /**< input buffer for parser*/;
 	size_t buf_allocated,/**< size of buffer "l->buf"*/
 		buf_used,     /**< amount of buffer used by current string*/
 		gc_stack_allocated, /**< length of buffer of GC stack*/
 		gc_stack_used,      /**< elements used in GC stack*/
-		gc_collectp;  /**< garbage collect after it goes too high*/
+		args_allocated,     /**< length of the argument stack*/
+		args_used,          /**< elements used in the argument stack*/
+		stack_limit;        /**< bytes the GC stack can hold calls in*/
 	lisp_editor_func editor; /**< line editor to use, optional*/
 	lisp_user_defined_funcs_t ufuncs[MAX_USER_TYPES]; /**< for user defined types*/
 	int user_defined_types_used;   /**< number of user defined types allocated*/
+	lisp_form_func forms[MAX_FORMS]; /**< special forms added by modules, by tag*/
+	unsigned forms_used;           /**< tag of the next special form added*/
 	int sig;   /**< set by signal handlers or other threads*/
 	int log_level; /** of lisp_log_level type, the log level */
 	unsigned ungettok:    1, /**< do we have a put-back token to read?*/
@@ -208,6 +367,12 @@ struct lisp {
 		color_on:     1, /**< REPL Colorize output*/
 		prompt_on:    1, /**< REPL '>' Turn prompt on*/
 		gc_off:       1, /**< turn the garbage collector off*/
+		gc_marking:   1, /**< the mark stack is being drained*/
+		gc_overflow:  1, /**< the mark stack overflowed, rescan heap*/
+		gc_generational: 1, /**< only collect young cells when possible*/
+		gc_incremental: 1, /**< collect a step at a time*/
+		gc_minor:     1, /**< the current collection is a minor one*/
+		vm_on:        1, /**< compile procedures to byte code and run them*/
 		editor_on:    1; /**< REPL Turn the line editor on*/
 	unsigned cur_depth; /**< current recursion depth of the interpreter*/
 };
@@ -223,11 +388,102 @@ struct lisp {
  * @return cell* the added cell, or NULL when an internal allocation failed**/
 lisp_cell_t *lisp_gc_add(lisp_t *l, lisp_cell_t *op);
 
+/**@brief  Make room for arguments on the argument stack, like the stack
+ *	 of temporary variables anything on it will not be collected
+ * @param  l lisp environment
+ * @param  n number of arguments to make room for
+ * @return size_t index of the first of the new elements**/
+size_t lisp_args_reserve(lisp_t *l, size_t n);
+
 /**@brief This only performs a sweep, no objects are marked, this effectively
  *	invalidates the lisp environment!
  * @param l      the lisp environment to sweep and invalidate**/
 void lisp_gc_sweep_only(lisp_t *l);
 
+/**@brief  Run a collection when the allocator decides one is needed,
+ *	 in generational mode this will usually be a minor collection.
+ * @param  l     the lisp environment to collect garbage in**/
+void lisp_gc_collect(lisp_t *l);
+
+/**@brief  Allocate a zeroed cell with "count" data fields from the heap
+ *	 pages, the cell is not added to the stack of temporary variables.
+ * @param  l     the lisp environment to allocate in
+ * @param  type  type of the cell, a CONS is tagged instead of having a
+ *               header to set
+ * @param  count number of data fields, at most GC_MAX_FIELDS
+ * @return cell* a new cell, this function does not return on failure**/
+lisp_cell_t *lisp_gc_alloc(lisp_t *l, lisp_type type, size_t count);
+
+/**@brief  Has a lambda body had its variables resolved? The flag is kept
+ *	 in the page of the cons cell, as it has no header.
+ * @param  x     a cons cell
+ * @return int   non zero if it has**/
+int lisp_gc_resolved(lisp_cell_t *x);
+
+/**@brief  Flag a lambda body as having had its variables resolved
+ * @param  x     a cons cell**/
+void lisp_gc_set_resolved(lisp_cell_t *x);
+
+/**@brief  Is a list being printed? This is used to find lists that
+ *	 contain themselves. The flag is kept in the page of the cons cell.
+ * @param  x     a cons cell
+ * @return int   non zero if it is**/
+int lisp_gc_printing(lisp_cell_t *x);
+
+/**@brief  Flag a list as being printed, or as done with
+ * @param  x     a cons cell
+ * @param  on    set or clear the flag**/
+void lisp_gc_set_printing(lisp_cell_t *x, int on);
+
+/**@brief Release all of the heap pages, every
+ *	cell allocated in the lisp environment is invalidated.
+ * @param l      the lisp environment to release the memory of**/
+void lisp_gc_release_all(lisp_t *l);
+
+/**@brief  Pick a random seed for a hash table
+ * @param  p      an address to mix in to the seed
+ * @return uint64_t a seed**/
+uint64_t hash_new_seed(const void *p);
+
+/**@brief  Hash a string as the tables made by hash_create() do
+ * @param  s      string to hash
+ * @param  len    its length
+ * @param  seed   seed of the table
+ * @return uint32_t the hash**/
+uint32_t hash_string(const char *s, size_t len, uint64_t seed);
+
+/**@brief  Create a table as hash_create() does, but with a given seed, the
+ *	 interpreter gives all of its tables the same seed so the hash of
+ *	 a key can be worked out once and used with any of them.
+ * @param  len    number of bins
+ * @param  seed   seed of the table
+ * @return hash_table_t* a new table or NULL**/
+hash_table_t *hash_create_seeded(size_t len, uint64_t seed);
+
+/**@brief  As hash_lookup(), but with the hash of the key already worked
+ *	 out by hash_string() with "seed". If the table hashes its keys
+ *	 in another way the key is hashed again.
+ * @return void* the value or NULL if it was not found**/
+void *hash_lookup_hashed(const hash_table_t *h, const char *key, uint32_t hash, uint64_t seed);
+
+/**@brief  As hash_insert(), but with the hash of the key already worked
+ *	 out by hash_string() with "seed"
+ * @return int 0 on success, < 0 on failure**/
+int hash_insert_hashed(hash_table_t *h, char *key, uint32_t hash, uint64_t seed, void *val);
+
+/**@brief  As hash_remove(), but with the hash of the key already worked
+ *	 out by hash_string() with "seed"
+ * @return int 0 if it was removed, < 0 if it was not found**/
+int hash_remove_hashed(hash_table_t *h, const char *key, uint32_t hash, uint64_t seed);
+
+/**@brief  Find the next entry in a hash table, for walking over every
+ *	 entry without a callback.
+ * @param  h      the hash table to walk over
+ * @param  i      position to start from, initially zero, it is updated
+ *                to be just after the entry returned
+ * @return hash_entry_t* the next entry or NULL if there are no more**/
+hash_entry_t *hash_iterate(const hash_table_t *h, size_t *i);
+
 /**@brief Read in a lisp expression
  * @param l      a lisp environment
  * @param i      the input port
@@ -250,12 +506,160 @@ int printer(lisp_t *l, io_t *o, lisp_cell_t *op, unsigned depth);
  * @return cell*  the evaluated expression **/
 lisp_cell_t *eval(lisp_t *l, unsigned depth, lisp_cell_t *exp, lisp_cell_t *env);
 
+/**@brief  Evaluate the body of a procedure, as "progn" would but without
+ *	   making a list to pass to eval()
+ * @param  l      the lisp environment to evaluate in
+ * @param  depth  current evaluation depth, not to exceed a limit
+ * @param  body   list of expressions to evaluate
+ * @param  env    the environment to evaluate in
+ * @return cell*  the value of the last expression, or nil if there are none **/
+lisp_cell_t *eval_body(lisp_t *l, unsigned depth, lisp_cell_t *body, lisp_cell_t *env);
+
 /**@brief  find a key in an association list (a-list)
+ * @param  l      the lisp environment the key and list belong to
  * @param  key    key to search for
  * @param  alist  association list
  * @return if key is found it returns a cons of the key and the associated
  *	 value, if not found it returns nil**/
-lisp_cell_t *lisp_assoc(lisp_cell_t *key, lisp_cell_t *alist);
+lisp_cell_t *lisp_assoc(lisp_t *l, lisp_cell_t *key, lisp_cell_t *alist);
+
+/**@brief  Get the hash of a symbol or string for the tables of the
+ *	 interpreter, it is worked out the first time it is needed and
+ *	 then kept in the cell. Symbols cannot be changed, and nor can
+ *	 the text of a string.
+ * @param  l      the lisp environment
+ * @param  x      a symbol or a string
+ * @return uint32_t the hash**/
+uint32_t get_key_hash(lisp_t *l, lisp_cell_t *x);
+
+/**@brief  Create a hash table for the interpreter which compares its keys
+ *	 with "test". Tables keyed on objects (HASH_EQ, HASH_EQL and
+ *	 HASH_EQUAL) store the key cell itself as the key, it is kept
+ *	 alive by being the car of the value. A user defined type is
+ *	 only ever the same key as itself.
+ * @param  l      the lisp environment
+ * @param  test   how keys are compared
+ * @param  len    initial number of bins
+ * @return hash_table_t* a new table or NULL**/
+hash_table_t *hash_create_test(lisp_t *l, hash_test_e test, size_t len);
+
+/**@brief  Find out how a table made by hash_create_test() compares its keys,
+ *	 any other table is treated as a string table.
+ * @param  h      a hash table
+ * @return hash_test_e how "h" compares its keys**/
+hash_test_e get_hash_test(hash_table_t *h);
+
+/**@brief  Look up a key in a hash table of the interpreter, whatever it
+ *	 is keyed on.
+ * @param  l      the lisp environment
+ * @param  h      table to search
+ * @param  key    key to look for, a string table never contains
+ *                anything but a symbol or string
+ * @return lisp_cell_t* a cons of the key and value, or NULL**/
+lisp_cell_t *lisp_hash_lookup(lisp_t *l, hash_table_t *h, lisp_cell_t *key);
+
+/**@brief  Add a key and its value to a hash table of the interpreter as a
+ *	 cons of the two, replacing any value the key already had.
+ * @param  l      the lisp environment
+ * @param  h      table to insert into
+ * @param  key    the key, which must be a symbol or a string if "h" is a
+ *                string table
+ * @param  val    the value
+ * @return int 0 on success, < 0 on failure**/
+int lisp_hash_insert(lisp_t *l, hash_table_t *h, lisp_cell_t *key, lisp_cell_t *val);
+
+/**@brief  Remove a key from a hash table of the interpreter
+ * @return int 0 if it was removed, < 0 if it was not found**/
+int lisp_hash_remove(lisp_t *l, hash_table_t *h, lisp_cell_t *key);
+
+/**@brief  Is a cell an environment frame? A frame holds the arguments of
+ *         a procedure call; the procedures argument list, which names each
+ *         slot, the environment it extends, the number of slots and then
+ *         the values themselves.
+ * @param  x cell to check
+ * @return int non-zero if it is a frame*/
+int is_frame(lisp_cell_t *x);
+
+/**@brief  Get the symbol that names a slot in a frame
+ * @param  x frame
+ * @param  i slot index, less than get_frame_count()
+ * @return lisp_cell_t* symbol naming the slot*/
+lisp_cell_t *get_frame_symbol(lisp_cell_t *x, size_t i);
+
+/**@brief  Get the value in a slot of a frame
+ * @param  x frame
+ * @param  i slot index, less than get_frame_count()
+ * @return lisp_cell_t* value of the slot*/
+lisp_cell_t *get_frame_value(lisp_cell_t *x, size_t i);
+
+/**@brief  Get the number of slots in a frame
+ * @param  x frame
+ * @return size_t number of slots*/
+size_t get_frame_count(lisp_cell_t *x);
+
+/**@brief  Get the environment a frame extends
+ * @param  x frame
+ * @return lisp_cell_t* the enclosing environment*/
+lisp_cell_t *get_frame_parent(lisp_cell_t *x);
+
+/**@brief  Make a new frame with all of its slots set to nil
+ * @param  l     lisp environment to allocate in
+ * @param  syms  argument list naming the slots
+ * @param  count number of slots, at most GC_MAX_FIELDS - FRAME_HEADER
+ * @param  env   environment the frame extends
+ * @return lisp_cell_t* the new frame*/
+lisp_cell_t *mk_frame(lisp_t *l, lisp_cell_t *syms, size_t count, lisp_cell_t *env);
+
+/**@brief  The number of slots a frame for an argument list needs, one for
+ *         each symbol including the one that takes the rest of the values
+ * @param  syms argument list
+ * @return size_t number of slots*/
+size_t frame_slots(lisp_cell_t *syms);
+
+/**@brief  Bind the values to the argument symbols of a procedure, in a new
+ *         frame on top of "env". The last symbol in a dotted argument list,
+ *         or a lone symbol, is bound to the rest of the values. Argument
+ *         lists too long to fit in a frame are bound as pairs instead.
+ * @param  l    lisp environment to allocate in
+ * @param  syms argument list
+ * @param  vals list of values
+ * @param  env  environment to extend
+ * @return lisp_cell_t* the new environment, or NULL if there were too few
+ *         values*/
+lisp_cell_t *env_bind(lisp_t *l, lisp_cell_t *syms, lisp_cell_t *vals, lisp_cell_t *env);
+
+/**@brief  Find where a symbol is bound in an environment of frames,
+ *         pairs and the top level hash
+ * @param  l     lisp environment
+ * @param  sym   symbol to look up
+ * @param  env   environment to look in
+ * @param  field set to the field of the returned cell holding the value
+ * @return lisp_cell_t* the pair or frame the binding is in, or NULL if it
+ *         is unbound*/
+lisp_cell_t *env_lookup(lisp_t *l, lisp_cell_t *sym, lisp_cell_t *env, size_t *field);
+
+/**@brief  Make a cell to hold the byte code of a procedure
+ * @param  l      lisp environment to allocate in
+ * @param  code   the code, freed along with the cell
+ * @param  consts list of the constants the code refers to
+ * @return lisp_cell_t* the new cell*/
+lisp_cell_t *mk_code(lisp_t *l, void *code, lisp_cell_t *consts);
+
+/**@brief  Compile the body of a procedure to byte code, procedures that
+ *         use anything the compiler does not handle are left alone and
+ *         are evaluated by eval() instead
+ * @param  l    lisp environment
+ * @param  proc procedure to compile
+ * @return int  non-zero if it was compiled*/
+int vm_compile(lisp_t *l, lisp_cell_t *proc);
+
+/**@brief  Run a compiled procedure
+ * @param  l     lisp environment
+ * @param  depth recursion depth
+ * @param  proc  procedure with byte code
+ * @param  env   environment with its arguments bound
+ * @return lisp_cell_t* the result*/
+lisp_cell_t *vm_run(lisp_t *l, unsigned depth, lisp_cell_t *proc, lisp_cell_t *env);
 
 /**@brief  Extend the top level lisp environment with a key value pair
  * @param  l   the lisp environment to perform the extension on
@@ -269,6 +673,36 @@ lisp_cell_t *lisp_extend_top(lisp_t *l, lisp_cell_t *sym, lisp_cell_t *val);
  * @return argument count**/
 size_t lisp_validate_arg_count(const char *fmt);
 
+/**@brief  Compile a validation format string into one type mask per
+ *         argument, which is quicker to check than the string
+ * @param  fmt   validation format string, as passed to lisp_validate_args()
+ * @param  masks where to put the masks
+ * @param  max   the most masks there is room for
+ * @return int   non zero if the string was compiled, grouped format
+ *         specifiers and strings with too many arguments are not**/
+int lisp_validate_compile(const char *fmt, cell_data_t *masks, size_t max);
+
+/**@brief  Get the argument type masks of a subroutine
+ * @param  x subroutine
+ * @return cell_data_t* one mask per argument, or NULL if its validation
+ *         string was not compiled**/
+cell_data_t *get_subr_masks(lisp_cell_t *x);
+
+/**@brief  Make a list out of a vector of arguments
+ * @param  l    lisp environment to allocate in
+ * @param  argc number of arguments
+ * @param  argv arguments
+ * @return lisp_cell_t* a list of the arguments**/
+lisp_cell_t *lisp_argv_list(lisp_t *l, size_t argc, lisp_cell_t **argv);
+
+/**@brief  Validate an argument list against a subroutine and call it,
+ *         whichever way the subroutine takes its arguments
+ * @param  l    lisp environment
+ * @param  x    subroutine
+ * @param  args list of evaluated arguments
+ * @return lisp_cell_t* the result**/
+lisp_cell_t *lisp_subr_call(lisp_t *l, lisp_cell_t *x, lisp_cell_t *args);
+
 /**@brief  Coerce an object from one type to another type, if possible
  * @param  l    an initialized lisp environment
  * @param  type the type to convert to
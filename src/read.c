@@ -154,19 +154,20 @@ static char *read_string(lisp_t * l, io_t * i) {
 	return NULL;
 }
 
-static int keyval(lisp_t * l, io_t * i, hash_table_t *ht, char *key) {
+static int keyval(lisp_t * l, io_t * i, lisp_cell_t *h, char *key) {
 	lisp_cell_t *val;
 	if (!(val = reader(l, i)))
 		return -1;
-	if (hash_insert(ht, key, cons(l, mk_str(l, key), val)) < 0)
+	if (lisp_hash_insert(l, get_hash(h), mk_str(l, key), val) < 0)
 		return -1;
+	lisp_gc_write_barrier(h);
 	return 0;
 }
 
 static lisp_cell_t *read_hash(lisp_t * l, io_t * i) {
 	hash_table_t *ht = NULL;
 	char *token = NULL;
-	if (!(ht = hash_create(SMALL_DEFAULT_LEN)))
+	if (!(ht = hash_create_test(l, HASH_STRING, SMALL_DEFAULT_LEN)))
 		lisp_out_of_memory(l);
 	lisp_cell_t *ret = mk_hash(l, ht);
 	for (;;) {
@@ -190,7 +191,7 @@ static lisp_cell_t *read_hash(lisp_t * l, io_t * i) {
 			token = NULL;
 			if (!(key = read_string(l, i)))
 				goto fail;
-			if (keyval(l, i, ht, key) < 0)
+			if (keyval(l, i, ret, key) < 0)
 				goto fail;
 			continue;
 		}
@@ -201,7 +202,7 @@ static lisp_cell_t *read_hash(lisp_t * l, io_t * i) {
 				goto fail;
 			}
 
-			if (keyval(l, i, ht, new_token(l)) < 0)
+			if (keyval(l, i, ret, new_token(l)) < 0)
 				goto fail;
 			free(token);
 			continue;
@@ -150,9 +150,11 @@ int lisp_repl(lisp_t * l, char *prompt, int editor_on) {
 				break;
 			lisp_printf(l, ofp, 0, "%S\n", ret);
 			l->gc_stack_used = 0;
+			l->args_used = 0;
 		}
 	}
 	l->gc_stack_used = 0;
+	l->args_used = 0;
 	l->recover_init = 0;
 	return r;
 }
@@ -31,18 +31,14 @@
 	X("apply",       subr_apply,     NULL,   "apply a function to an argument list")\
 	X("assoc",       subr_assoc,     "A c",  "lookup a variable in an 'a-list'")\
 	X("base",        subr_base,      "d d",  "convert a integer into a string in a base")\
-	X("car",         subr_car,       "L",    "return the first object in a list")\
-	X("cdr",         subr_cdr,       "L",    "return every object apart from the first in a list")\
 	X("is-closed",   subr_is_closed, NULL,   "is a object closed?")\
 	X("close",       subr_close,     "P",    "close a port, invalidating it")\
 	X("coerce",      subr_coerce,    NULL,   "coerce a variable from one type to another")\
-	X("cons",        subr_cons,      "A A",  "allocate a new cons cell with two arguments")\
 	X("copy",        subr_copy,      "A",    "perform a recursive copy of an expression, if possible")\
 	X("define-eval", subr_define_eval, "s A", "extend the top level environment with a computed symbol")\
 	X("depth",       subr_depth,     "",      "get the current evaluation depth")\
 	X("environment", subr_environment, "",    "get the current environment")\
 	X("is-eof",      subr_eofp,      "P",    "is the EOF flag set on a port?")\
-	X("eq",          subr_eq,        "A A",  "equality operation")\
 	X("eval",        subr_eval,      NULL,   "evaluate an expression")\
 	X("ferror",      subr_ferror,    "P",    "is the error flag set on a port")\
 	X("flush",       subr_flush,     NULL,   "flush a port")\
@@ -53,9 +49,11 @@
 	X("get-system-variable", subr_getenv,    "Z",    "get an environment variable from the system (not thread safe)")\
 	X("get-io-str",  subr_get_io_str,"P",    "get a copy of a string from an IO string port")\
 	X("hash-create", subr_hash_create,   NULL,   "create a new hash")\
+	X("hash-create-with", subr_hash_create_with, NULL, "create a new hash keyed on objects compared with eq, eql or equal")\
 	X("hash-info",   subr_hash_info,     "h",    "get information about a hash")\
-	X("hash-insert", subr_hash_insert,   "h Z A", "insert a variable into a hash")\
-	X("hash-lookup", subr_hash_lookup,   "h Z",  "loop up a variable in a hash")\
+	X("hash-insert", subr_hash_insert,   "h A A", "insert a variable into a hash")\
+	X("hash-lookup", subr_hash_lookup,   "h A",  "loop up a variable in a hash")\
+	X("hash-remove", subr_hash_remove,   "h A",  "remove a variable from a hash")\
 	X("is-input",    subr_inp,       "A",    "is an object an input port?")\
 	X("length",      subr_length,    "A",    "return the length of a list or string")\
 	X("match",       subr_match,     "Z Z",  "perform a primitive match on a string")\
@@ -76,31 +74,53 @@
 	X("set-car",     subr_setcar,    "c A",  "destructively set the first cell of a cons cell")\
 	X("set-cdr",     subr_setcdr,    "c A",  "destructively set the second cell of a cons cell")\
 	X("signal",      subr_signal,     "d",    "raise a signal")\
+	X("substring",   subr_substring, NULL,   "create a substring from a string")\
+	X("tell",        subr_tell,      "P",    "return the position indicator of a port")\
+	X("top-environment", subr_top_env, "",   "return the top level environment")\
+	X("trace",       subr_trace,     "d",    "set the log level, from no errors printed, to copious debugging information")\
+	X("tr",          subr_tr,        "Z Z Z Z", "translate a string given a format and mode")\
+	X("type-of",     subr_typeof,    "A",    "return an integer representing the type of an object")
+
+/* Primitives that are passed their arguments as a vector on the argument
+ * stack instead of as a freshly made list, in the same format as above.
+ * These are the ones called most often, they do not evaluate anything
+ * themselves, see mk_vsubr() */
+#define VSUBROUTINE_XLIST\
+	X("car",         subr_car,       "L",    "return the first object in a list")\
+	X("cdr",         subr_cdr,       "L",    "return every object apart from the first in a list")\
+	X("cons",        subr_cons,      "A A",  "allocate a new cons cell with two arguments")\
+	X("eq",          subr_eq,        "A A",  "equality operation")\
 	X("&",           subr_band,      "d d",  "bit-wise and of two integers")\
 	X("~",           subr_binv,      "d",    "bit-wise inversion of an integers")\
 	X("|",           subr_bor,       "d d",  "bit-wise or of two integers")\
 	X("^",           subr_bxor,      "d d",  "bit-wise xor of two integers")\
 	X("<<",          subr_lshift,    "d d",  "logical left shift an integer")\
 	X(">>",          subr_rshift,    "d d",  "logical right shift an integer")\
-	X("/",           subr_div,       "a a",  "divide operation")\
-	X("=",           subr_eq,        "A A",  "equality operation")\
-	X(">",           subr_greater,   NULL,   "greater operation")\
-	X("<",           subr_less,      NULL,   "less than operation")\
+	X("/",           subr_div,       NULL,   "divide the first number by the rest")\
+	X("=",           subr_equal,     NULL,   "are all of the arguments equal?")\
+	X(">",           subr_greater,   NULL,   "is each argument greater than the next?")\
+	X("<",           subr_less,      NULL,   "is each argument less than the next?")\
 	X("%",           subr_mod,       "d d",  "modulo operation")\
-	X("*",           subr_prod,      "a a",  "multiply two numbers")\
-	X("-",           subr_sub,       "a a",  "subtract two numbers")\
-	X("+",           subr_sum,       "a a",  "add two numbers")\
-	X("substring",   subr_substring, NULL,   "create a substring from a string")\
-	X("tell",        subr_tell,      "P",    "return the position indicator of a port")\
-	X("top-environment", subr_top_env, "",   "return the top level environment")\
-	X("trace",       subr_trace,     "d",    "set the log level, from no errors printed, to copious debugging information")\
-	X("tr",          subr_tr,        "Z Z Z Z", "translate a string given a format and mode")\
-	X("type-of",     subr_typeof,    "A",    "return an integer representing the type of an object")
+	X("*",           subr_prod,      NULL,   "multiply numbers together")\
+	X("-",           subr_sub,       NULL,   "subtract the rest of the numbers from the first, or negate one")\
+	X("+",           subr_sum,       NULL,   "add numbers together")
+
+/* Primitives without side effects whose result depends only on their
+ * arguments, "compile" folds calls to them when their arguments are
+ * constant numbers. Division and modulo are not included as they raise
+ * errors for some constant arguments. */
+#define PURE_XLIST\
+	X("&") X("~") X("|") X("^") X("<<") X(">>")\
+	X("=") X(">") X("<") X("*") X("-") X("+") X("eq")
 
 #define X(NAME, SUBR, VALIDATION, DOCSTRING) static lisp_cell_t * SUBR (lisp_t *l, lisp_cell_t *args);
 SUBROUTINE_XLIST /*function prototypes for all of the built-in subroutines*/
 #undef X
 
+#define X(NAME, SUBR, VALIDATION, DOCSTRING) static lisp_cell_t * SUBR (lisp_t *l, size_t argc, lisp_cell_t **argv);
+VSUBROUTINE_XLIST
+#undef X
+
 #define X(NAME, SUBR, VALIDATION, DOCSTRING) { NAME, VALIDATION, MK_DOCSTR(NAME, DOCSTRING), SUBR },
 static const lisp_module_subroutines_t primitives[] = {
         SUBROUTINE_XLIST /*all of the subr functions*/
@@ -133,15 +153,15 @@ static const struct integer_list { char *name; intptr_t val; } integers[] = {
 };
 #undef X
 
-#define X(CNAME, LNAME) static lisp_cell_t _ ## CNAME = { SYMBOL, 0, 1, 0, 0, .p[0].v = LNAME};
+#define X(CNAME, LNAME, FORM) static lisp_cell_t _ ## CNAME = { SYMBOL, 1, 0, 0, .form = FORM, .p[0].v = LNAME};
 CELL_XLIST /*structs for special cells*/
 #undef X
 
-#define X(CNAME, NOT_USED) static lisp_cell_t * CNAME = & _ ## CNAME;
+#define X(CNAME, NOT_USED, FORM) static lisp_cell_t * CNAME = & _ ## CNAME;
 CELL_XLIST /*pointers to structs for special cells*/
 #undef X
 
-#define X(CNAME, NOT_USED) { & _ ## CNAME },
+#define X(CNAME, NOT_USED, FORM) { & _ ## CNAME },
 /**@brief a list of all the special symbols**/
 static const struct special_cell_list { lisp_cell_t *internal; } special_cells[] = {
         CELL_XLIST
@@ -149,7 +169,7 @@ static const struct special_cell_list { lisp_cell_t *internal; } special_cells[]
 };
 #undef X
 
-#define X(FNAME, IGNORE) lisp_cell_t *gsym_ ## FNAME (void) { return FNAME ; }
+#define X(FNAME, IGNORE, FORM) lisp_cell_t *gsym_ ## FNAME (void) { return FNAME ; }
 CELL_XLIST /**< defines functions to get a lisp "cell" for the built in special symbols*/
 #undef X
 
@@ -158,11 +178,13 @@ static lisp_cell_t *forced_add_symbol(lisp_t *l, lisp_cell_t *ob) {
         assert(hash_lookup(get_hash(l->all_symbols), get_sym(ob)) == NULL);
         if (hash_insert(get_hash(l->all_symbols), get_sym(ob), ob) < 0)
 		return NULL;
+	lisp_gc_write_barrier(l->all_symbols);
         return l->tee;
 }
 
 lisp_t *lisp_init(void) {
         lisp_t *l;
+        lisp_cell_t *tmp;
         io_t *ifp, *ofp, *efp;
         unsigned i;
         if (!(l = calloc(1, sizeof(*l))))  goto fail;
@@ -173,24 +195,35 @@ lisp_t *lisp_init(void) {
 	lisp_set_log_level(l, LISP_LOG_LEVEL_ERROR);
 
         l->gc_off = 1;
+        l->gc_generational = 1;
+        l->gc_threshold = GC_HEAP_MINIMUM;
+        l->gc_pause = GC_PAUSE;
+        l->gc_stepmul = GC_STEP_MULTIPLIER;
+        l->vm_on = 1;
+        l->stack_limit = STACK_LIMIT;
+        l->forms_used = FORM_USER;
         if (!(l->buf = calloc(DEFAULT_LEN, 1))) goto fail;
         l->buf_allocated = DEFAULT_LEN;
         if (!(l->gc_stack = calloc(DEFAULT_LEN, sizeof(*l->gc_stack))))
                 goto fail;
         l->gc_stack_allocated = DEFAULT_LEN;
+        if (!(l->args = calloc(DEFAULT_LEN, sizeof(*l->args))))
+                goto fail;
+        l->args_allocated = DEFAULT_LEN;
 
-#define X(CNAME, LNAME) l-> CNAME = CNAME;
+#define X(CNAME, LNAME, FORM) l-> CNAME = CNAME;
 CELL_XLIST
 #undef X
         assert(MAX_RECURSION_DEPTH < INT_MAX);
 
         /* The lisp init function is now ready to add built in subroutines
          * and other variables, the order in which is does this matters. */
-        if (!(l->all_symbols = mk_hash(l, hash_create(DEFAULT_LEN))))
+        l->hash_seed = hash_new_seed(l);
+        if (!(l->all_symbols = mk_hash(l, hash_create_seeded(DEFAULT_LEN, l->hash_seed))))
                 goto fail;
         if (!(l->top_env = cons(l, cons(l, l->nil, l->nil), l->nil)))
                 goto fail;
-        if (!(l->top_hash = mk_hash(l, hash_create(DEFAULT_LEN))))
+        if (!(l->top_hash = mk_hash(l, hash_create_seeded(DEFAULT_LEN, l->hash_seed))))
                 goto fail;
          set_cdr(l->top_env, cons(l, l->top_hash, cdr(l->top_env)));
 
@@ -228,6 +261,13 @@ CELL_XLIST
                                         mk_int(l, integers[i].val)))
                         goto fail;
 	lisp_add_module_subroutines(l, primitives, 0);
+#define X(NAME, SUBR, VALIDATION, DOCSTRING)\
+	if (!lisp_add_vsubr(l, NAME, SUBR, VALIDATION, MK_DOCSTR(NAME, DOCSTRING))) goto fail;
+	VSUBROUTINE_XLIST
+#undef X
+#define X(NAME) if ((tmp = hash_lookup(get_hash(l->top_hash), NAME))) cdr(tmp)->pure = 1;
+	PURE_XLIST
+#undef X
         l->gc_off = 0;
         return l;
 fail:   l->gc_off = 0;
@@ -235,167 +275,227 @@ fail:   l->gc_off = 0;
         return NULL;
 }
 
-static lisp_cell_t *subr_band(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (uintptr_t)get_int(car(args)) & (uintptr_t)get_int(CADR(args)));
+static lisp_cell_t *subr_band(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	UNUSED(argc);
+	return mk_int(l, (uintptr_t)get_int(argv[0]) & (uintptr_t)get_int(argv[1]));
 }
 
-static lisp_cell_t *subr_bor(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (uintptr_t)get_int(car(args)) | (uintptr_t)get_int(CADR(args)));
+static lisp_cell_t *subr_bor(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	UNUSED(argc);
+	return mk_int(l, (uintptr_t)get_int(argv[0]) | (uintptr_t)get_int(argv[1]));
 }
 
-static lisp_cell_t *subr_bxor(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (uintptr_t)get_int(car(args)) ^ (uintptr_t)get_int(CADR(args)));
+static lisp_cell_t *subr_bxor(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	UNUSED(argc);
+	return mk_int(l, (uintptr_t)get_int(argv[0]) ^ (uintptr_t)get_int(argv[1]));
 }
 
-static lisp_cell_t *subr_lshift(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (uintptr_t)get_int(car(args)) << (uintptr_t)get_int(CADR(args)));
+static lisp_cell_t *subr_lshift(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	UNUSED(argc);
+	return mk_int(l, (uintptr_t)get_int(argv[0]) << (uintptr_t)get_int(argv[1]));
 }
 
-static lisp_cell_t *subr_rshift(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, (uintptr_t)get_int(car(args)) >> (uintptr_t)get_int(CADR(args)));
+static lisp_cell_t *subr_rshift(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	UNUSED(argc);
+	return mk_int(l, (uintptr_t)get_int(argv[0]) >> (uintptr_t)get_int(argv[1]));
 }
 
-static lisp_cell_t *subr_binv(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, ~get_int(car(args)));
+static lisp_cell_t *subr_binv(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	UNUSED(argc);
+	return mk_int(l, ~get_int(argv[0]));
 }
 
-/** For numerical operations
- * @todo Floating point numbers should infect the operation:
- *       float + integer = float, integer + float = float
- * @todo Add in overloads for user defined types
- * @todo Take an arbitrary number of arguments */
+/** For numerical operations, these take any number of arguments and
+ * keep a running total in C until the end, so only the result is made.
+ * The total is an integer until a float is seen, after which it is a
+ * float, so "(+ 1 2.5)" and "(+ 2.5 1)" are both 3.5.
+ * @todo Add in overloads for user defined types */
+typedef enum { ARITH_SUM, ARITH_SUB, ARITH_PROD, ARITH_DIV } arith_e;
 
-static lisp_cell_t *subr_sum(lisp_t * l, lisp_cell_t * args) {
-	lisp_cell_t *x = car(args), *y = CADR(args);
-	if (is_int(x))
-		return mk_int(l, get_int(x) + get_a2i(y));
-	return mk_float(l, get_float(x) + get_a2f(y));
+static lisp_cell_t *arith(lisp_t *l, arith_e op, size_t argc, lisp_cell_t **argv) {
+	intptr_t i = op == ARITH_PROD || op == ARITH_DIV, d;
+	lisp_float_t f = 0., g;
+	int floating = 0;
+	size_t n = 0;
+	for (n = 0; n < argc; n++)
+		if (!is_arith(argv[n]))
+			LISP_RECOVER(l, "\"expected numbers\"\n '%S", lisp_argv_list(l, argc, argv));
+	if (argc == 0 && (op == ARITH_SUB || op == ARITH_DIV))
+		LISP_RECOVER(l, "\"expected at least one number\"\n '%S", l->nil);
+	n = argc > 1 ? 1 : 0; /* a single argument is negated or inverted */
+	if (n) {
+		if ((floating = is_floating(argv[0])))
+			f = get_float(argv[0]);
+		else
+			i = get_int(argv[0]);
+	}
+	for (; n < argc; n++) {
+		if (!floating && is_floating(argv[n])) {
+			floating = 1;
+			f = (lisp_float_t)i;
+		}
+		if (floating) {
+			g = get_a2f(argv[n]);
+			switch (op) {
+			case ARITH_SUM:  f += g; break;
+			case ARITH_SUB:  f -= g; break;
+			case ARITH_PROD: f *= g; break;
+			case ARITH_DIV:
+				if (g == 0.)
+					LISP_RECOVER(l, "\"division by zero\"\n '%S", lisp_argv_list(l, argc, argv));
+				f /= g;
+				break;
+			}
+			continue;
+		}
+		d = get_int(argv[n]);
+		switch (op) {
+		case ARITH_SUM:  i += d; break;
+		case ARITH_SUB:  i -= d; break;
+		case ARITH_PROD: i *= d; break;
+		case ARITH_DIV:
+			if (!d || (i == INTPTR_MIN && d == -1))
+				LISP_RECOVER(l, "\"invalid divisor values\"\n '%S", lisp_argv_list(l, argc, argv));
+			i /= d;
+			break;
+		}
+	}
+	return floating ? mk_float(l, f) : mk_int(l, i);
 }
 
-static lisp_cell_t *subr_sub(lisp_t * l, lisp_cell_t * args) {
-	lisp_cell_t *x = car(args), *y = CADR(args);
-	if (is_int(x))
-		return mk_int(l, get_int(x) - get_a2i(y));
-	return mk_float(l, get_float(x) - get_a2f(y));
+static lisp_cell_t *subr_sum(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	return arith(l, ARITH_SUM, argc, argv);
 }
 
-static lisp_cell_t *subr_prod(lisp_t * l, lisp_cell_t * args) {
-	lisp_cell_t *x = car(args), *y = CADR(args);
-	if (is_int(x))
-		return mk_int(l, get_int(x) * get_a2i(y));
-	return mk_float(l, get_float(x) * get_a2f(y));
+static lisp_cell_t *subr_sub(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	return arith(l, ARITH_SUB, argc, argv);
 }
 
-static lisp_cell_t *subr_mod(lisp_t * l, lisp_cell_t * args) {
+static lisp_cell_t *subr_prod(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	return arith(l, ARITH_PROD, argc, argv);
+}
+
+static lisp_cell_t *subr_mod(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
 	intptr_t dividend, divisor;
-	dividend = get_int(car(args));
-	divisor = get_int(CADR(args));
+	dividend = get_int(argv[0]);
+	divisor = get_int(argv[1]);
 	if (!divisor || (dividend == INTPTR_MIN && divisor == -1))
-		LISP_RECOVER(l, "\"invalid divisor values\"\n '%S", args);
+		LISP_RECOVER(l, "\"invalid divisor values\"\n '%S", lisp_argv_list(l, argc, argv));
 	return mk_int(l, dividend % divisor);
 }
 
-static lisp_cell_t *subr_div(lisp_t * l, lisp_cell_t * args) {
-	lisp_float_t dividend, divisor;
-	if (is_int(car(args))) {
-		intptr_t dividend, divisor;
-		dividend = get_int(car(args));
-		divisor = get_a2i(CADR(args));
-		if (!divisor || (dividend == INTPTR_MIN && divisor == -1))
-			LISP_RECOVER(l, "\"invalid divisor values\"\n '%S", args);
-		return mk_int(l, dividend / divisor);
-	}
-	dividend = get_float(car(args));
-	divisor = get_a2f(CADR(args));
-	if (divisor == 0.)
-		LISP_RECOVER(l, "\"division by zero\"\n '%S", args);
-	return mk_float(l, dividend / divisor);
+static lisp_cell_t *subr_div(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	return arith(l, ARITH_DIV, argc, argv);
 }
 
-static lisp_cell_t *subr_greater(lisp_t * l, lisp_cell_t * args) {
-	lisp_cell_t *x, *y;
-	if (!lisp_check_length(args, 2))
-		goto fail;
-	x = car(args);
-	y = CADR(args);
-	if (is_arith(x) && is_arith(y)) {
-		return (is_floating(x) ? get_float(x) : get_int(x)) >
-		    (is_floating(y) ? get_float(y) : get_int(y)) ? l->tee : l->nil;
-	} else if (is_asciiz(x) && is_asciiz(y)) {
+/**@brief compare two numbers, or two strings, for the ordering operators
+ * @return int negative, zero or positive as "x" is less than, equal to or
+ *             greater than "y"*/
+static int compare(lisp_t *l, size_t argc, lisp_cell_t **argv, lisp_cell_t *x, lisp_cell_t *y) {
+	if (is_int(x) && is_int(y))
+		return (get_int(x) > get_int(y)) - (get_int(x) < get_int(y));
+	if (is_arith(x) && is_arith(y))
+		return (get_a2f(x) > get_a2f(y)) - (get_a2f(x) < get_a2f(y));
+	if (is_asciiz(x) && is_asciiz(y)) {
 		size_t lx = get_length(x), ly = get_length(y);
 		if (lx == ly)
-			return memcmp(get_str(x), get_str(y), lx) > 0 ? l->tee : l->nil;
-		return lx > ly ? l->tee : l->nil;
+			return memcmp(get_str(x), get_str(y), lx);
+		return (lx > ly) - (lx < ly);
 	}
- fail:	LISP_RECOVER(l, "\"expected (number number) or (string string)\"\n '%S", args);
-	return l->error;
+	LISP_RECOVER(l, "\"expected numbers or strings\"\n '%S", lisp_argv_list(l, argc, argv));
+	return 0;
 }
 
-static lisp_cell_t *subr_less(lisp_t * l, lisp_cell_t * args) {
-	lisp_cell_t *x, *y;
-	if (!lisp_check_length(args, 2))
-		goto fail;
-	x = car(args);
-	y = CADR(args);
-	if (is_arith(x) && is_arith(y)) {
-		return (is_floating(x) ? get_float(x) : get_int(x)) <
-		    (is_floating(y) ? get_float(y) : get_int(y)) ? l->tee : l->nil;
-	} else if (is_asciiz(x) && is_asciiz(y)) {
-		size_t lx = get_length(x), ly = get_length(y);
-		if (lx == ly)
-			return memcmp(get_str(x), get_str(y), lx) < 0 ? l->tee : l->nil;
-		return lx < ly ? l->tee : l->nil;
-	}
- fail:	LISP_RECOVER(l, "\"expected (number number) or (string string)\"\n '%S", args);
-	return l->error;
+static lisp_cell_t *subr_greater(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	lisp_cell_t *r = l->tee;
+	if (!argc)
+		LISP_RECOVER(l, "\"expected at least one number or string\"\n '%S", l->nil);
+	for (size_t i = 1; i < argc; i++)
+		if (compare(l, argc, argv, argv[i - 1], argv[i]) <= 0)
+			r = l->nil; /* keep going so all arguments are checked */
+	return r;
 }
 
-static lisp_cell_t *subr_eq(lisp_t * l, lisp_cell_t * args) {
+static lisp_cell_t *subr_less(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	lisp_cell_t *r = l->tee;
+	if (!argc)
+		LISP_RECOVER(l, "\"expected at least one number or string\"\n '%S", l->nil);
+	for (size_t i = 1; i < argc; i++)
+		if (compare(l, argc, argv, argv[i - 1], argv[i]) >= 0)
+			r = l->nil;
+	return r;
+}
+
+/**@brief are two cells the same, for "eq", numbers must also be of the
+ * same type to be the same*/
+static int same(lisp_t *l, lisp_cell_t *x, lisp_cell_t *y) {
 	/**@warning Most versions of equality treat the floating
 	 * point value NaN specially, NaN does not equal NaN,
 	 * disregarding the reflexive property that is usually
 	 * expected for equality. However this implementation
-	 * compares the raw values contained within a cell first,
-	 * meaning NaN == NaN, but only on some platforms! (the
-	 * size of a lisp float could be greater than or less
-	 * than a pointer. What should be done needs to be decided. */
-	lisp_cell_t *x, *y;
-	x = car(args);
-	y = CADR(args);
-	if (get_int(x) == get_int(y))
-		return l->tee;
+	 * compares the cells themselves first, meaning a NaN is
+	 * equal to itself when it is the same cell. What should be
+	 * done needs to be decided. */
+	if (x == y)
+		return 1;
+	if (is_int(x) && is_int(y))
+		return get_int(x) == get_int(y);
 	if (is_floating(x) && is_floating(y))
-		return get_float(x) == get_float(y) ? l->tee : l->nil;
+		return get_float(x) == get_float(y);
 	if (is_str(x) && is_str(y)) {
 		size_t lx = get_length(x), ly = get_length(y);
 		if (lx == ly)
-			return !memcmp(get_str(x), get_str(y), lx) ? l->tee : l->nil;
+			return !memcmp(get_str(x), get_str(y), lx);
 	}
 	if (is_userdef(x) && is_userdef(y) && get_user_type(x) == get_user_type(y))
 		if (l->ufuncs[get_user_type(x)].equal)
-			return (l->ufuncs[get_user_type(x)].equal) (x, y) ? l->tee : l->nil;
+			return (l->ufuncs[get_user_type(x)].equal) (x, y);
+	return 0;
+}
 
-	return l->nil;
+/**@brief are two cells equal, for "=", an integer compared with a float
+ * is converted to a float first*/
+static int equal(lisp_t *l, lisp_cell_t *x, lisp_cell_t *y) {
+	if (is_arith(x) && is_arith(y) && (is_floating(x) || is_floating(y)))
+		return get_a2f(x) == get_a2f(y);
+	return same(l, x, y);
 }
 
-static lisp_cell_t *subr_cons(lisp_t * l, lisp_cell_t * args) {
-	return cons(l, car(args), CADR(args));
+static lisp_cell_t *subr_eq(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	UNUSED(argc);
+	return same(l, argv[0], argv[1]) ? l->tee : l->nil;
+}
+
+static lisp_cell_t *subr_equal(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	if (!argc)
+		LISP_RECOVER(l, "\"expected at least one argument\"\n '%S", l->nil);
+	for (size_t i = 1; i < argc; i++)
+		if (!equal(l, argv[i - 1], argv[i]))
+			return l->nil;
+	return l->tee;
+}
+
+static lisp_cell_t *subr_cons(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	UNUSED(argc);
+	return cons(l, argv[0], argv[1]);
 }
 
 static lisp_cell_t *subr_copy(lisp_t * l, lisp_cell_t * args) {
 	return lisp_copy(l, car(args));
 }
 
-static lisp_cell_t *subr_car(lisp_t * l, lisp_cell_t * args) {
-	if (is_nil(car(args)))
+static lisp_cell_t *subr_car(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	UNUSED(argc);
+	if (is_nil(argv[0]))
 		return l->nil;
-	return CAAR(args);
+	return car(argv[0]);
 }
 
-static lisp_cell_t *subr_cdr(lisp_t * l, lisp_cell_t * args) {
-	if (is_nil(car(args)))
+static lisp_cell_t *subr_cdr(lisp_t * l, size_t argc, lisp_cell_t ** argv) {
+	UNUSED(argc);
+	if (is_nil(argv[0]))
 		return l->nil;
-	return CDAR(args);
+	return cdr(argv[0]);
 }
 
 static lisp_cell_t *subr_setcar(lisp_t * l, lisp_cell_t * args) {
@@ -436,6 +536,7 @@ static lisp_cell_t *subr_scdr(lisp_t * l, lisp_cell_t * args) {
 static lisp_cell_t *subr_eval(lisp_t * l, lisp_cell_t * args) {
 	lisp_cell_t *x = NULL;
 	int restore_used, r, errors_halt = l->errors_halt;
+	size_t args_used = l->args_used, gc_stack_used = l->gc_stack_used;
 	jmp_buf restore;
 	l->errors_halt = 0;
 	if (l->recover_init) {
@@ -444,6 +545,8 @@ static lisp_cell_t *subr_eval(lisp_t * l, lisp_cell_t * args) {
 	}
 	l->recover_init = 1;
 	if ((r = setjmp(l->recover))) {
+		l->args_used = args_used;
+		l->gc_stack_used = gc_stack_used;
 		LISP_RECOVER_RESTORE(restore_used, l, restore);
 		l->errors_halt = errors_halt;
 		return l->error;
@@ -452,7 +555,7 @@ static lisp_cell_t *subr_eval(lisp_t * l, lisp_cell_t * args) {
 	if (lisp_check_length(args, 1))
 		x = eval(l, l->cur_depth, car(args), l->top_env);
 	if (lisp_check_length(args, 2)) {
-		if (!is_cons(CADR(args)))
+		if (!is_cons(CADR(args)) && !is_frame(CADR(args)))
 			LISP_RECOVER(l, "\"expected a-list\"\n '%S", args);
 		x = eval(l, l->cur_depth, car(args), CADR(args));
 	}
@@ -614,35 +717,65 @@ static lisp_cell_t *subr_rename(lisp_t * l, lisp_cell_t * args) {
 	return rename(get_str(car(args)), get_str(CADR(args))) ? l->nil : l->tee;
 }
 
-static lisp_cell_t *subr_hash_lookup(lisp_t * l, lisp_cell_t * args) { /*arbitrary expressions could be used as keys if they are serialized to strings first*/
-	lisp_cell_t *x;
-	return (x = hash_lookup(get_hash(car(args)), get_sym(CADR(args)))) ? x : l->nil;
+static lisp_cell_t *subr_hash_lookup(lisp_t * l, lisp_cell_t * args) {
+	lisp_cell_t *x = lisp_hash_lookup(l, get_hash(car(args)), CADR(args));
+	return x ? x : l->nil;
 }
 
 static lisp_cell_t *subr_hash_insert(lisp_t * l, lisp_cell_t * args) {
-	if (hash_insert(get_hash(car(args)),
-			get_sym(CADR(args)), cons(l, CADR(args), CADR(cdr(args)))))
+	hash_table_t *ht = get_hash(car(args));
+	if (get_hash_test(ht) == HASH_STRING && !is_asciiz(CADR(args)))
+		LISP_RECOVER(l, "\"expected a symbol or string key\"\n '%S", args);
+	if (lisp_hash_insert(l, ht, CADR(args), CADR(cdr(args))) < 0)
 		lisp_out_of_memory(l);
+	lisp_gc_write_barrier(car(args));
+	l->binding_version++; /* the hash could be part of an environment */
 	return car(args);
 }
 
-static lisp_cell_t *subr_hash_create(lisp_t * l, lisp_cell_t * args) {
+static lisp_cell_t *subr_hash_remove(lisp_t * l, lisp_cell_t * args) {
+	if (lisp_hash_remove(l, get_hash(car(args)), CADR(args)) < 0)
+		return l->nil;
+	l->binding_version++;
+	return l->tee;
+}
+
+/**@brief make a hash table comparing its keys with "test" from a list of
+ * keys and values*/
+static lisp_cell_t *hash_from_list(lisp_t *l, hash_test_e test, lisp_cell_t *args) {
 	hash_table_t *ht = NULL;
 	if (get_length(args) % 2)
-		goto fail;
-	if (!(ht = hash_create(SMALL_DEFAULT_LEN)))
+		return NULL;
+	if (!(ht = hash_create_test(l, test, SMALL_DEFAULT_LEN)))
 		lisp_out_of_memory(l);
 	for (; !is_nil(args); args = cdr(cdr(args))) {
-		if (!is_asciiz(car(args)))
-			goto fail;
-		if (hash_insert(ht, get_sym(car(args)), cons(l, car(args), CADR(args))) < 0)
+		if (test == HASH_STRING && !is_asciiz(car(args))) {
+			hash_destroy(ht);
+			return NULL;
+		}
+		if (lisp_hash_insert(l, ht, car(args), CADR(args)) < 0)
 			lisp_out_of_memory(l);
 	}
 	return mk_hash(l, ht);
- fail:	hash_destroy(ht);
-	ht = NULL;
-	LISP_RECOVER(l, "\"expected ({symbol any}*)\"\n '%S", args);
-	return l->error;
+}
+
+static lisp_cell_t *subr_hash_create(lisp_t * l, lisp_cell_t * args) {
+	lisp_cell_t *h = hash_from_list(l, HASH_STRING, args);
+	if (!h)
+		LISP_RECOVER(l, "\"expected ({symbol any}*)\"\n '%S", args);
+	return h;
+}
+
+static lisp_cell_t *subr_hash_create_with(lisp_t * l, lisp_cell_t * args) {
+	static const char *tests[] = { [HASH_EQ] = "eq", [HASH_EQL] = "eql", [HASH_EQUAL] = "equal" };
+	lisp_cell_t *h = NULL;
+	if (is_cons(args) && is_sym(car(args)))
+		for (size_t i = HASH_EQ; i <= HASH_EQUAL; i++)
+			if (!strcmp(get_sym(car(args)), tests[i]))
+				h = hash_from_list(l, i, cdr(args));
+	if (!h)
+		LISP_RECOVER(l, "\"expected ({eq eql equal} {any any}*)\"\n '%S", args);
+	return h;
 }
 
 static lisp_cell_t *subr_hash_info(lisp_t * l, lisp_cell_t * args) {
@@ -651,7 +784,8 @@ static lisp_cell_t *subr_hash_info(lisp_t * l, lisp_cell_t * args) {
 		       mk_float(l, hash_get_load_factor(ht)),
 		       mk_int(l,   hash_get_replacements(ht)),
 		       mk_int(l,   hash_get_collision_count(ht)),
-		       mk_int(l,   hash_get_number_of_bins(ht)), NULL);
+		       mk_int(l,   hash_get_number_of_bins(ht)),
+		       mk_int(l,   hash_get_bins_to_move(ht)), NULL);
 }
 
 static lisp_cell_t *subr_coerce(lisp_t * l, lisp_cell_t * args) {
@@ -665,9 +799,9 @@ static lisp_cell_t *subr_coerce(lisp_t * l, lisp_cell_t * args) {
 lisp_cell_t *lisp_coerce(lisp_t * l, lisp_type type, lisp_cell_t *from) {
 	char *fltend = NULL;
 	intptr_t d = 0;
-	size_t i = 0, j;
+	size_t i = 0;
 	lisp_cell_t *x, *y, *head;
-	if (type == from->type)
+	if (type == TYPE(from))
 		return from;
 	switch (type) {
 	case INTEGER:
@@ -701,15 +835,13 @@ lisp_cell_t *lisp_coerce(lisp_t * l, lisp_type type, lisp_cell_t *from) {
 			hash_entry_t *cur;
 			hash_table_t *h = get_hash(from);
 			head = x = cons(l, l->nil, l->nil);
-			for (j = 0, i = 0; i < h->len; i++)
-				if (h->table[i])
-					for (cur = h->table[i]; cur; cur = cur->next, j++) {
-						lisp_cell_t *tmp = (lisp_cell_t *) cur->val;
-						if (!is_cons(tmp))	/*handle special case for all_symbols hash */
-							tmp = cons(l, tmp, tmp);
-						set_cdr(x, cons(l, tmp, l->nil));
-						x = cdr(x);
-					}
+			for (i = 0; (cur = hash_iterate(h, &i));) {
+				lisp_cell_t *tmp = (lisp_cell_t *) cur->val;
+				if (!is_cons(tmp))	/*handle special case for all_symbols hash */
+					tmp = cons(l, tmp, tmp);
+				set_cdr(x, cons(l, tmp, l->nil));
+				x = cdr(x);
+			}
 			return cdr(head);
 		}
 		break;
@@ -772,12 +904,11 @@ lisp_cell_t *lisp_coerce(lisp_t * l, lisp_type type, lisp_cell_t *from) {
 }
 
 static lisp_cell_t *subr_assoc(lisp_t * l, lisp_cell_t * args) {
-	UNUSED(l);
-	return lisp_assoc(car(args), CADR(args));
+	return lisp_assoc(l, car(args), CADR(args));
 }
 
 static lisp_cell_t *subr_typeof(lisp_t * l, lisp_cell_t * args) {
-	return mk_int(l, car(args)->type);
+	return mk_int(l, TYPE(car(args)));
 }
 
 static lisp_cell_t *subr_close(lisp_t * l, lisp_cell_t * args) {
@@ -793,7 +924,7 @@ static lisp_cell_t *subr_reverse(lisp_t * l, lisp_cell_t * args) {
 		goto fail;
 	if (l->nil == car(args))
 		return l->nil;
-	switch (car(args)->type) {
+	switch (TYPE(car(args))) {
 	case STRING:
 		{
 			char *s = lisp_strdup(l, get_str(car(args)));
@@ -820,26 +951,27 @@ static lisp_cell_t *subr_reverse(lisp_t * l, lisp_cell_t * args) {
 		{ /*only certain hashes are reversible*/
 			hash_table_t *old = get_hash(car(args));
 			size_t len = hash_get_number_of_bins(old);
-			size_t i;
-			hash_table_t *new = hash_create(len);
+			size_t i = 0;
+			hash_test_e test = get_hash_test(old);
+			hash_table_t *new = hash_create_test(l, test, len);
 			hash_entry_t *cur;
-			for (i = 0; i < old->len; i++)
-				if (old->table[i])
-					for (cur = old->table[i]; cur; cur = cur->next) {
-						lisp_cell_t *key, *val;
-						/**@warning weird hash stuff*/
-						if (is_cons(cur->val) && is_asciiz(cdr(cur->val))) {
-							key = cdr(cur->val);
-							val = car(cur->val);
-						} else if (!is_cons(cur->val) && is_asciiz(cur->val)) {
-							key = cur->val;
-							val = mk_str(l, lisp_strdup(l, cur->key));
-						} else {
-							goto hfail;
-						}
-						if (hash_insert(new, get_str(key), cons(l, key, val)) < 0)
-							lisp_out_of_memory(l);
-					}
+			if (!new)
+				lisp_out_of_memory(l);
+			while ((cur = hash_iterate(old, &i))) {
+				lisp_cell_t *key, *val;
+				/**@warning weird hash stuff*/
+				if (is_cons(cur->val) && (test != HASH_STRING || is_asciiz(cdr(cur->val)))) {
+					key = cdr(cur->val);
+					val = car(cur->val);
+				} else if (!is_cons(cur->val) && is_asciiz(cur->val)) {
+					key = cur->val;
+					val = mk_str(l, lisp_strdup(l, cur->key));
+				} else {
+					goto hfail;
+				}
+				if (lisp_hash_insert(l, new, key, val) < 0)
+					lisp_out_of_memory(l);
+			}
 			return mk_hash(l, new);
 hfail:
 			hash_destroy(new);
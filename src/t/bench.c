@@ -0,0 +1,350 @@
+/** @file     bench.c
+ *  @brief    benchmarks for the liblisp interpreter
+ *  @author   Richard Howe (2015)
+ *  @license  LGPL v2.1 or Later
+ *            <https://www.gnu.org/licenses/old-licenses/lgpl-2.1.en.html>
+ *  @email    howe.r.j.89@gmail.com
+ *
+ *  @note     Unlike the unit tests this pokes at the internals of the
+ *            interpreter, as the REPL does, so that the stack of
+ *            temporary variables can be reset between evaluations.
+ **/
+
+#include "liblisp.h"
+#include "private.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ITERATIONS (20000) /**< evaluations timed per run*/
+
+static int compare_clock(const void *a, const void *b)
+{
+	clock_t x = *(const clock_t *)a, y = *(const clock_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double usecs(clock_t t)
+{
+	return t * 1000000.0 / CLOCKS_PER_SEC;
+}
+
+/**@brief time a series of short evaluations against a large live heap, a
+ * collection will show up as a long pause for one of them*/
+static void pauses(const char *name, int incremental, size_t cells, size_t us)
+{
+	static clock_t times[ITERATIONS];
+	lisp_t *l = lisp_init();
+	assert(l);
+	io_close(lisp_get_logging(l));
+	lisp_set_logging(l, io_nout());
+	lisp_gc_set_incremental(l, incremental);
+	lisp_gc_set_step_budget(l, cells, us);
+	lisp_eval_string(l, "(define build (lambda (n acc) (if (= n 0) acc (build (- n 1) (cons n acc)))))");
+	lisp_eval_string(l, "(define keep (build 200000 nil))");
+	l->gc_stack_used = 0;
+	for (size_t i = 0; i < ITERATIONS; i++) {
+		clock_t start = clock();
+		lisp_eval_string(l, "(build 100 nil)");
+		times[i] = clock() - start;
+		l->gc_stack_used = 0;
+	}
+	qsort(times, ITERATIONS, sizeof(times[0]), compare_clock);
+	printf("%-24s p50 %8.1fus  p99 %8.1fus  max %8.1fus\n", name,
+			usecs(times[ITERATIONS / 2]),
+			usecs(times[ITERATIONS * 99 / 100]),
+			usecs(times[ITERATIONS - 1]));
+	lisp_destroy(l);
+}
+
+/**@brief time a loop of calls to global subroutines, which compiled code
+ * finds through its inline caches*/
+static void calls(const char *name, int vm, intptr_t n)
+{
+	char buf[64];
+	lisp_t *l = lisp_init();
+	assert(l);
+	io_close(lisp_get_logging(l));
+	lisp_set_logging(l, io_nout());
+	lisp_set_vm(l, vm);
+	lisp_eval_string(l, "(define loop (lambda (n) (let (l '(1 2 3)) (s 0) "
+			"(progn (while (> n 0) (setq s (+ s (car (cdr l)))) (setq n (- n 1))) s))))");
+	sprintf(buf, "(loop %ld)", (long)n);
+	clock_t start = clock();
+	lisp_cell_t *r = lisp_eval_string(l, buf);
+	clock_t t = clock() - start;
+	assert(get_int(r) == 2 * n);
+	printf("%-24s %8.1fns per iteration\n", name, usecs(t) * 1000.0 / n);
+	lisp_destroy(l);
+}
+
+/**@brief a chained hash table, as hash.c used to be, to compare against,
+ * each entry is allocated on its own and a bin points to a list of them*/
+typedef struct chain {
+	char *key;
+	void *val;
+	struct chain *next;
+} chain_t;
+
+typedef struct {
+	chain_t **bins;
+	size_t len, used;
+} chained_t;
+
+static chained_t *chained_create(size_t len)
+{
+	chained_t *h = calloc(1, sizeof(*h));
+	assert(h);
+	h->bins = calloc(len, sizeof(*h->bins));
+	assert(h->bins);
+	h->len = len;
+	return h;
+}
+
+static void chained_destroy(chained_t *h)
+{
+	for (size_t i = 0; i < h->len; i++)
+		for (chain_t *c = h->bins[i], *n; c; c = n) {
+			n = c->next;
+			free(c);
+		}
+	free(h->bins);
+	free(h);
+}
+
+static void chained_grow(chained_t *h)
+{
+	size_t len = h->len * 2;
+	chain_t **bins = calloc(len, sizeof(*bins));
+	assert(bins);
+	for (size_t i = 0; i < h->len; i++)
+		for (chain_t *c = h->bins[i], *n; c; c = n) {
+			uint32_t b = djb2(c->key, strlen(c->key)) % len;
+			n = c->next;
+			c->next = bins[b];
+			bins[b] = c;
+		}
+	free(h->bins);
+	h->bins = bins;
+	h->len = len;
+}
+
+static void chained_insert(chained_t *h, char *key, void *val)
+{
+	if ((double)h->used / h->len >= 0.75)
+		chained_grow(h);
+	uint32_t b = djb2(key, strlen(key)) % h->len;
+	for (chain_t *c = h->bins[b]; c; c = c->next)
+		if (!strcmp(c->key, key)) {
+			c->val = val;
+			return;
+		}
+	chain_t *c = calloc(1, sizeof(*c));
+	assert(c);
+	c->key = key;
+	c->val = val;
+	c->next = h->bins[b];
+	h->bins[b] = c;
+	h->used++;
+}
+
+static void *chained_lookup(chained_t *h, const char *key)
+{
+	for (chain_t *c = h->bins[djb2(key, strlen(key)) % h->len]; c; c = c->next)
+		if (!strcmp(c->key, key))
+			return c->val;
+	return NULL;
+}
+
+/**@brief shuffle an array of strings, with a fixed seed so runs compare*/
+static void shuffle(char **a, size_t n, uint64_t seed)
+{
+	for (size_t i = n - 1; i > 0; i--) {
+		seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+		size_t j = (seed >> 33) % (i + 1);
+		char *t = a[i];
+		a[i] = a[j];
+		a[j] = t;
+	}
+}
+
+/**@brief time inserting "n" string keys into a hash table, then looking
+ * each of them up and looking up as many keys that are not there, each in
+ * a random order, small tables are rebuilt until about ten million keys
+ * have been inserted*/
+static void hashes(size_t n)
+{
+	size_t rounds = n < 10000000 ? 10000000 / n : 1, found = 0;
+	char *text = malloc(n * 2 * 12), **keys = malloc(n * sizeof(*keys));
+	char **hits = malloc(n * sizeof(*hits)), **missing = malloc(n * sizeof(*missing));
+	clock_t t[2][3] = { { 0 } };
+	assert(text && keys && hits && missing);
+	for (size_t i = 0; i < n; i++) {
+		sprintf(keys[i] = hits[i] = &text[i * 12], "k%zu", i);
+		sprintf(missing[i] = &text[(n + i) * 12], "m%zu", i);
+	}
+	shuffle(keys, n, 1);
+	shuffle(hits, n, 2);
+	shuffle(missing, n, 3);
+	for (size_t r = 0; r < rounds; r++) {
+		clock_t start = clock();
+		hash_table_t *h = hash_create(64);
+		assert(h);
+		for (size_t i = 0; i < n; i++)
+			hash_insert(h, keys[i], keys[i]);
+		t[0][0] += clock() - start;
+		start = clock();
+		for (size_t i = 0; i < n; i++)
+			found += !!hash_lookup(h, hits[i]);
+		t[0][1] += clock() - start;
+		start = clock();
+		for (size_t i = 0; i < n; i++)
+			found += !!hash_lookup(h, missing[i]);
+		t[0][2] += clock() - start;
+		hash_destroy(h);
+
+		start = clock();
+		chained_t *c = chained_create(64);
+		for (size_t i = 0; i < n; i++)
+			chained_insert(c, keys[i], keys[i]);
+		t[1][0] += clock() - start;
+		start = clock();
+		for (size_t i = 0; i < n; i++)
+			found += !!chained_lookup(c, hits[i]);
+		t[1][1] += clock() - start;
+		start = clock();
+		for (size_t i = 0; i < n; i++)
+			found += !!chained_lookup(c, missing[i]);
+		t[1][2] += clock() - start;
+		chained_destroy(c);
+	}
+	assert(found == 2 * n * rounds);
+	for (size_t i = 0; i < 2; i++)
+		printf("%-10s %-8zu insert %6.1fns  hit %6.1fns  miss %6.1fns\n",
+				i ? "chained" : "open", n,
+				usecs(t[i][0]) * 1000.0 / (n * rounds),
+				usecs(t[i][1]) * 1000.0 / (n * rounds),
+				usecs(t[i][2]) * 1000.0 / (n * rounds));
+	free(text);
+	free(keys);
+	free(hits);
+	free(missing);
+}
+
+/**@brief time the string hash functions on strings of "len" bytes*/
+static void hash_functions(size_t len)
+{
+	enum { N = 4000000 };
+	char s[1024];
+	uint64_t x = 0;
+	assert(len <= sizeof(s));
+	memset(s, 'x', len);
+	clock_t start = clock();
+	for (size_t i = 0; i < N; i++)
+		x += djb2(s, len), s[0] = i;
+	clock_t t = clock() - start;
+	start = clock();
+	for (size_t i = 0; i < N; i++)
+		x += wyhash(s, len, 0), s[0] = i;
+	clock_t u = clock() - start;
+	printf("%-4zu bytes  djb2 %6.1fns  wyhash %6.1fns  (%d)\n", len,
+			usecs(t) * 1000.0 / N, usecs(u) * 1000.0 / N, (int)(x & 1));
+}
+
+/**@brief time each insertion of "n" keys on its own, a table that has
+ * to move all of its entries when it grows shows up as a long pause*/
+static void insert_pauses(size_t n)
+{
+	char *text = malloc(n * 12), **keys = malloc(n * sizeof(*keys));
+	clock_t *times = malloc(n * sizeof(*times));
+	assert(text && keys && times);
+	for (size_t i = 0; i < n; i++)
+		sprintf(keys[i] = &text[i * 12], "k%zu", i);
+	shuffle(keys, n, 1);
+	for (size_t j = 0; j < 2; j++) {
+		hash_table_t *h = j ? NULL : hash_create(64);
+		chained_t *c = j ? chained_create(64) : NULL;
+		for (size_t i = 0; i < n; i++) {
+			clock_t start = clock();
+			if (h)
+				hash_insert(h, keys[i], keys[i]);
+			else
+				chained_insert(c, keys[i], keys[i]);
+			times[i] = clock() - start;
+		}
+		qsort(times, n, sizeof(times[0]), compare_clock);
+		printf("%-10s %-8zu p99 %8.1fus  max %8.1fus\n",
+				j ? "chained" : "open", n,
+				usecs(times[n * 99 / 100]), usecs(times[n - 1]));
+		if (h)
+			hash_destroy(h);
+		else
+			chained_destroy(c);
+	}
+	free(text);
+	free(keys);
+	free(times);
+}
+
+/**@brief look up "n" integers in a table of the interpreter twice, once
+ * formatted into strings as the keys of a string table, as a memoising
+ * cache had to be, and once as the keys of an eql table*/
+static void integer_keys(size_t n)
+{
+	lisp_t *l = lisp_init();
+	assert(l);
+	for (size_t j = 0; j < 2; j++) {
+		hash_table_t *h = hash_create_test(l, j ? HASH_EQL : HASH_STRING, 64);
+		lisp_cell_t *table = mk_hash(l, h);
+		assert(h && table);
+		lisp_gc_used(table);
+		clock_t start = clock();
+		for (size_t r = 0; r < 2; r++)
+			for (size_t i = 0; i < n; i++) {
+				lisp_cell_t *key;
+				if (j) {
+					key = mk_int(l, i);
+				} else {
+					char buf[32];
+					sprintf(buf, "%zu", i);
+					key = mk_str(l, lisp_strdup(l, buf));
+				}
+				if (!r)
+					lisp_hash_insert(l, h, key, key);
+				else
+					assert(lisp_hash_lookup(l, h, key));
+			}
+		clock_t t = clock() - start;
+		lisp_gc_not_used(table);
+		printf("%-10s %-8zu %8.1fns\n", j ? "eql" : "string", n, usecs(t) * 1000.0 / (2 * n));
+	}
+	lisp_destroy(l);
+}
+
+int main(void)
+{
+	printf("string hash functions, per string\n");
+	hash_functions(8);
+	hash_functions(32);
+	hash_functions(256);
+	printf("hash table insertion times\n");
+	insert_pauses(10000000);
+	printf("hash tables with string keys, per key\n");
+	hashes(1000);
+	hashes(100000);
+	hashes(10000000);
+	printf("integer keys, per insertion or lookup\n");
+	integer_keys(1000);
+	integer_keys(1000000);
+	printf("car, cdr and + in a while loop\n");
+	calls("evaluated", 0, 1000000);
+	calls("byte code", 1, 1000000);
+	printf("gc pause times, %d evaluations each\n", ITERATIONS);
+	pauses("stop the world", 0, 0, 0);
+	pauses("incremental 4096 cells", 1, 4096, 0);
+	pauses("incremental 1024 cells", 1, 1024, 0);
+	pauses("incremental 100us", 1, 0, 100);
+	return 0;
+}
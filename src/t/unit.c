@@ -18,6 +18,7 @@
 
 /*** module to test ***/
 #include "liblisp.h"
+#include "lispmod.h"
 /**********************/
 
 #include <assert.h>
@@ -168,6 +169,95 @@ static int sstrcmp(const char *s1, const char *s2)
 	return strcmp(s1, s2);
 }
 
+/* a special form added from C, (unless test expr) */
+static lisp_cell_t *form_unless(lisp_t *l, unsigned depth, lisp_cell_t *args, lisp_cell_t *env)
+{
+	if (!lisp_check_length(args, 2))
+		return gsym_error();
+	if (!is_nil(lisp_eval_form(l, depth, car(args), env)))
+		return gsym_nil();
+	return lisp_eval_form(l, depth, CADR(args), env);
+}
+
+/* a subroutine passed its arguments as a vector, returns how many it got */
+static lisp_cell_t *subr_count(lisp_t *l, size_t argc, lisp_cell_t **argv)
+{
+	UNUSED(argv);
+	return mk_int(l, argc);
+}
+
+/* count the distinct hashes of the prefixes of a string, up to 100 bytes long */
+static size_t distinct_prefix_hashes(void)
+{
+	char s[101];
+	uint64_t h[101];
+	size_t distinct = 0;
+	for (size_t i = 0; i < 100; i++)
+		s[i] = 'a' + i % 26;
+	for (size_t i = 0; i <= 100; i++) {
+		h[i] = wyhash(s, i, 0);
+		size_t j = 0;
+		while (j < i && h[j] != h[i])
+			j++;
+		distinct += j == i;
+	}
+	return distinct;
+}
+
+/* insert the numbers up to "n" into a hash, as keys and values */
+static size_t insert_keys(hash_table_t *h, char (*keys)[8], size_t n)
+{
+	size_t inserted = 0;
+	for (size_t i = 0; i < n; i++) {
+		sprintf(keys[i], "%zu", i);
+		inserted += !hash_insert(h, keys[i], keys[i]);
+	}
+	return inserted;
+}
+
+/* look up the keys added by insert_keys() */
+static size_t lookup_keys(hash_table_t *h, char (*keys)[8], size_t n)
+{
+	size_t found = 0;
+	for (size_t i = 0; i < n; i++)
+		found += hash_lookup(h, keys[i]) == keys[i];
+	return found;
+}
+
+/* remove the first "n" keys added by insert_keys() */
+static size_t remove_keys(hash_table_t *h, char (*keys)[8], size_t n)
+{
+	size_t removed = 0;
+	for (size_t i = 0; i < n; i++)
+		removed += !hash_remove(h, keys[i]);
+	return removed;
+}
+
+/* a hash function for hash_create_custom(), which does not take a seed */
+static uint32_t first_char_hash(const void *key)
+{
+	return *(const char *)key;
+}
+
+static int key_compare(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+static void key_no_free(void *p)
+{
+	UNUSED(p);
+}
+
+/* cells allocated so far, of every type */
+static size_t allocations(lisp_t *l)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < LISP_GC_STATS_TYPES; i++)
+		n += lisp_gc_stats(l)->allocated[i];
+	return n;
+}
+
 int main(int argc, char **argv)
 {
 	if (argc > 1)
@@ -254,6 +344,13 @@ int main(int argc, char **argv)
 		/*should not collide */
 		test(djb2("heliotropes", strlen("heliotropes")) !=
 		     djb2("serafins", strlen("serafins")));
+
+		/*wyhash depends on its seed, and every prefix of a string, which
+		 *covers each of the ways it reads its input, hashes differently*/
+		test(wyhash("heliotropes", 11, 1) == wyhash("heliotropes", 11, 1));
+		test(wyhash("heliotropes", 11, 1) != wyhash("heliotropes", 11, 2));
+		test(wyhash("heliotropes", 11, 1) != wyhash("neurospora", 10, 1));
+		test(distinct_prefix_hashes() == 101);
 	}
 
 	{ /*io.c test */
@@ -326,7 +423,7 @@ int main(int argc, char **argv)
 		return_if(!h);
 		test(!hash_insert(h, "key1", "val1"));
 		test(!hash_insert(h, "key2", "val2"));
-		/* assuming the hash algorithm is djb2, then
+		/* for the djb2 hash algorithm, which the tables used to use,
 		 *  "heliotropes"  collides with "neurospora"
 		 *  "depravement"  collides with "serafins"
 		 *  "playwright"   collides with "snush" (for djb2a)
@@ -356,7 +453,50 @@ int main(int argc, char **argv)
 		test(!sstrcmp("z", hash_lookup(h, "a")));
 		test(hash_get_load_factor(h) <= 0.75f);
 
+		/*entries are moved about as others are inserted and the table
+		 *grows, but all of them must still be found, and in a copy*/
+		static char keys[1000][8];
+		test(insert_keys(h, keys, 1000) == 1000);
+		test(lookup_keys(h, keys, 1000) == 1000);
+		test(!hash_lookup(h, "1000"));
+		test(hash_get_load_factor(h) <= 0.75f);
+		hash_table_t *c = hash_copy(h);
+		test(c);
+		test(lookup_keys(c, keys, 1000) == 1000);
+		test(!sstrcmp("val3", hash_lookup(c, "heliotropes")));
+		state(hash_destroy(c));
 		state(hash_destroy(h));
+
+		/*growing moves a few bins with each insertion, until it is done
+		 *entries are found in either set of bins, and removing most of
+		 *the entries shrinks the table again*/
+		hash_table_t *g = hash_create(1024);
+		test(g);
+		test(insert_keys(g, keys, 769) == 769);
+		test(hash_get_number_of_bins(g) == 2048);
+		test(hash_get_bins_to_move(g) > 0);
+		test(lookup_keys(g, keys, 769) == 769);
+		test(!hash_remove(g, keys[0]) && !hash_lookup(g, keys[0]));
+		test(hash_remove(g, keys[0]) < 0);
+		test(insert_keys(g, keys, 1000) == 1000);
+		test(!hash_get_bins_to_move(g));
+		test(remove_keys(g, keys, 990) == 990);
+		test(lookup_keys(g, keys, 1000) == 10);
+		test(hash_get_number_of_bins(g) <= 64);
+		state(hash_destroy(g));
+
+		/*hash functions that take no seed still work, the seed of the
+		 *table is mixed in afterwards*/
+		hash_table_t *u = hash_create_custom(16, key_no_free, key_no_free, key_compare, first_char_hash);
+		test(u);
+		test(insert_keys(u, keys, 100) == 100);
+		test(lookup_keys(u, keys, 100) == 100);
+		test(remove_keys(u, keys, 50) == 50);
+		test(lookup_keys(u, keys, 100) == 50);
+		c = hash_copy(u);
+		test(c && lookup_keys(c, keys, 100) == 50);
+		state(hash_destroy(c));
+		state(hash_destroy(u));
 	}
 
 	{			/* lisp.c (and the lisp interpreter in general) */
@@ -375,7 +515,7 @@ int main(int argc, char **argv)
 		test(get_int(lisp_eval_string(l, "(* 3 2)")) == 6);
 
 		lisp_cell_t *x = NULL, *y = NULL, *z = NULL;
-		char *t = NULL;
+		char *t = NULL, *serial = NULL;
 		state(x = lisp_intern(l, lstrdup_or_abort("foo")));
 		state(y = lisp_intern(l, t = lstrdup_or_abort("foo")));	/*this one needs freeing! */
 		state(z = lisp_intern(l, lstrdup_or_abort("bar")));
@@ -386,20 +526,243 @@ int main(int argc, char **argv)
 		test(is_proc(lisp_eval_string(l, "(define square (lambda (x) (* x x)))")));
 		test(get_int(lisp_eval_string(l, "(square 4)")) == 16);
 
+		/*variables are resolved to lexical addresses when a lambda is made*/
+		test(is_proc(lisp_eval_string(l, "(define shadow (lambda (x) (lambda (y) (let (a x) (x y) (cons a x)))))")));
+		test(get_int(car(lisp_eval_string(l, "((shadow 1) 2)"))) == 1);
+		test(get_int(cdr(lisp_eval_string(l, "((shadow 1) 2)"))) == 2);
+		test(get_int(lisp_eval_string(l, "((lambda (x) (eval 'x (environment))) 3)")) == 3);
+		test(!strcmp((serial = lisp_serialize(l, lisp_eval_string(l, "(shadow 1)"))), "(lambda \"\" (y) (let (a x) (x y) (cons a x)))"));
+		state(free(serial));
+		/*the list a lambda is made from is left as it was*/
+		test(is_cons(lisp_eval_string(l, "(define source '(lambda (x) (+ x 1)))")));
+		test(get_int(lisp_eval_string(l, "((eval source) 1)")) == 2);
+		test(gsym_tee() == lisp_eval_string(l, "(eq 'x (car (cdr (car (cdr (cdr source))))))"));
+
+		/*procedure arguments are bound in a frame*/
+		test(is_proc(lisp_eval_string(l, "(define counter (lambda (n) (lambda () (setq n (+ n 1)))))")));
+		test(is_proc(lisp_eval_string(l, "(define count (counter 10))")));
+		test(get_int(lisp_eval_string(l, "(count)")) == 11);
+		test(get_int(lisp_eval_string(l, "(count)")) == 12);
+		test(get_int(CADR(lisp_eval_string(l, "((lambda (a . b) b) 1 2 3)"))) == 3);
+		test(get_length(lisp_eval_string(l, "((lambda a a) 1 2 3)")) == 3);
+		test(get_int(lisp_eval_string(l, "(eval '(+ p q) ((lambda (p q) (environment)) 5 6))")) == 11);
+
+		/*top level bindings are kept on the symbol*/
+		test(get_int(lisp_eval_string(l, "(define global 1)")) == 1);
+		test(get_int(lisp_eval_string(l, "(define global 2)")) == 2);
+		test(get_int(lisp_eval_string(l, "(setq global 3)")) == 3);
+		test(get_int(lisp_eval_string(l, "global")) == 3);
+		test(get_int(lisp_eval_string(l, "((lambda (global) global) 4)")) == 4);
+
+		/*integers are kept in the cell pointer when they fit, so
+		 *arithmetic on them does not allocate*/
+		test(get_int(mk_int(l, INTPTR_MAX)) == INTPTR_MAX);
+		test(get_int(mk_int(l, INTPTR_MIN)) == INTPTR_MIN);
+		test(get_int(mk_int(l, -1)) == -1);
+		test(is_int(mk_int(l, 0)) && !is_closed(mk_int(l, 0)));
+		test(gsym_tee() == lisp_eval_string(l, "(eq 100 100)"));
+		test(is_nil(lisp_eval_string(l, "(eq (cons 1 2) (cons 1 3))")));
+		test(get_int(lisp_eval_string(l, "(define n 0)")) == 0);
+		volatile size_t cells = allocations(l);
+		test(is_nil(lisp_eval_string(l, "(while (< n 10000) (setq n (+ n 1)))")));
+		test(allocations(l) - cells < 100);
+
+		/*subroutines can be passed a vector of arguments instead of a
+		 *list, their validation strings are compiled to type masks*/
+		test(lisp_add_vsubr(l, "count", subr_count, NULL, NULL));
+		test(is_vsubr(lisp_eval_string(l, "count")));
+		test(is_vsubr(lisp_eval_string(l, "+")));
+		test(get_int(lisp_eval_string(l, "(count)")) == 0);
+		test(get_int(lisp_eval_string(l, "(count 1 (count 2 3) (+ 4 5))")) == 3);
+		test(gsym_error() == lisp_eval_string(l, "(% 1)"));
+		test(gsym_error() == lisp_eval_string(l, "(car 1)"));
+		test(is_nil(lisp_eval_string(l, "(car nil)")));
+		test(gsym_error() == lisp_eval_string(l, "(hash-lookup 1 'a)"));
+		test(gsym_tee() == lisp_eval_string(l, "(hash-remove (hash-create 'a 1) 'a)"));
+		test(is_nil(lisp_eval_string(l, "(hash-remove (hash-create 'a 1) 'b)")));
+		/*symbols and strings with the same name share a cached hash, and a
+		 *table made with its own seed is still searched correctly*/
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup (hash-create \"a\" 1) 'a)"))) == 1);
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup {a 2} \"a\")"))) == 2);
+		test(lisp_add_cell(l, "unseeded", mk_hash(l, hash_create(16))));
+		test(is_hash(lisp_eval_string(l, "(hash-insert unseeded 'b 3)")));
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup unseeded \"b\")"))) == 3);
+		test(gsym_tee() == lisp_eval_string(l, "(hash-remove unseeded \"b\")"));
+		test(gsym_tee() == lisp_eval_string(l, "(hash-remove (hash-create \"nil\" 1) nil)"));
+		/*tables keyed on objects*/
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup (hash-create-with 'eql 1 2 1.5 3) 1)"))) == 2);
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup (hash-create-with 'eql 1 2 1.5 3) 1.5)"))) == 3);
+		test(is_nil(lisp_eval_string(l, "(hash-lookup (hash-create-with 'eql 1 2) 1.0)")));
+		test(is_nil(lisp_eval_string(l, "(hash-lookup (hash-create-with 'eq \"a\" 1) \"a\")")));
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup (hash-create-with 'equal \"a\" 1) \"a\")"))) == 1);
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup (hash-create-with 'equal '(1 (\"a\")) 4) (cons 1 (cons (cons \"a\" nil) nil)))"))) == 4);
+		test(is_nil(lisp_eval_string(l, "(hash-lookup (hash-create-with 'equal '(1 2) 4) '(1 3))")));
+		/*circular keys are still hashed and compared in bounded time*/
+		test(is_hash(lisp_eval_string(l, "(define circular (hash-create-with 'equal))")));
+		test(is_cons(lisp_eval_string(l, "(define cdr-loop (cons 1 (cons 2 nil)))")));
+		test(is_cons(lisp_eval_string(l, "(set-cdr (cdr cdr-loop) cdr-loop)")));
+		test(is_cons(lisp_eval_string(l, "(define car-loop (cons 1 (cons 2 nil)))")));
+		test(is_cons(lisp_eval_string(l, "(set-car car-loop car-loop)")));
+		test(is_hash(lisp_eval_string(l, "(hash-insert circular cdr-loop 1)")));
+		test(is_hash(lisp_eval_string(l, "(hash-insert circular car-loop 2)")));
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup circular cdr-loop)"))) == 1);
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup circular car-loop)"))) == 2);
+		test(is_nil(lisp_eval_string(l, "(hash-lookup circular '(1 2 1 2))")));
+		test(is_cons(lisp_eval_string(l, "(define cdr-loop-copy (cons 1 (cons 2 nil)))")));
+		test(is_cons(lisp_eval_string(l, "(set-cdr (cdr cdr-loop-copy) cdr-loop-copy)")));
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup circular cdr-loop-copy)"))) == 1);
+		/*keys longer than the part of them that is hashed*/
+		lisp_cell_t *long_key = gsym_nil(), *long_copy = gsym_nil();
+		for (intptr_t i = 0; i < 300; i++) {
+			long_key = cons(l, mk_int(l, i), long_key);
+			long_copy = cons(l, mk_int(l, i), long_copy);
+		}
+		test(lisp_add_cell(l, "long-key", long_key) && lisp_add_cell(l, "long-copy", long_copy));
+		test(is_hash(lisp_eval_string(l, "(hash-insert circular long-key 3)")));
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup circular long-copy)"))) == 3);
+		test(is_nil(lisp_eval_string(l, "(hash-lookup circular (cdr long-copy))")));
+		test(is_hash(lisp_eval_string(l, "(define memo (hash-create-with 'eql))")));
+		test(get_int(lisp_eval_string(l, "(define k 0)")) == 0);
+		test(is_nil(lisp_eval_string(l, "(while (< k 20000) (progn (hash-insert memo k (* k k)) (setq k (+ k 1))))")));
+		test(get_int(cdr(lisp_eval_string(l, "(hash-lookup memo 12345)"))) == 12345 * 12345);
+		test(gsym_tee() == lisp_eval_string(l, "(hash-remove memo 12345)"));
+		test(is_nil(lisp_eval_string(l, "(hash-lookup memo 12345)")));
+		test(gsym_error() == lisp_eval_string(l, "(hash-insert (hash-create) 1 2)"));
+		test(gsym_error() == lisp_eval_string(l, "(hash-create-with 'string)"));
+		test(gsym_error() == lisp_eval_string(l, "(count 1 . 2)"));
+
+		/*lambdas are compiled to byte code unless the compiler is off,
+		 *both must give the same results*/
+		for (volatile int vm = 0; vm < 2; vm++) {
+			state(lisp_set_vm(l, vm));
+			test(is_proc(lisp_eval_string(l, "(define fact (lambda (n) (if (< n 2) 1 (* n (fact (- n 1))))))")));
+			test(get_int(lisp_eval_string(l, "(fact 10)")) == 3628800);
+			test(is_proc(lisp_eval_string(l, "(define spin (lambda (n) (if (= n 0) 'done (spin (- n 1)))))")));
+			test(is_sym(lisp_eval_string(l, "(spin 100000)")));
+			test(is_proc(lisp_eval_string(l, "(define spin-let (lambda (n) (let (m (- n 1)) (cond ((= m 0) 'done) (t (progn (spin-let m)))))))")));
+			test(is_sym(lisp_eval_string(l, "(spin-let 100000)")));
+			test(get_int(lisp_eval_string(l, "((lambda (x) (let (y (+ x 1)) (z (* y 2)) (progn (setq x z) x))) 1)")) == 4);
+			test(get_int(lisp_eval_string(l, "((lambda (l) (cond ((= l 1) 10) (t 20))) 2)")) == 20);
+			test(get_length(lisp_eval_string(l, "((lambda (f) (f a b c)) (flambda \"\" (x) x))")) == 3);
+			test(gsym_error() == lisp_eval_string(l, "((lambda (x) (undefined-variable x)) 1)"));
+			test(get_int(CDDR(lisp_eval_string(l, "((lambda () (cons 1 (cons (lambda () 2) 3))))"))) == 3);
+			test(get_int(cdr(lisp_eval_string(l, "((lambda (a) (cons a (let (b 2) b))) 1)"))) == 2);
+			test(gsym_error() == lisp_eval_string(l, "((lambda () ((lambda (a b) a) 1)))"));
+			test(get_int(lisp_eval_string(l, "((lambda (x) (count x (count x x) x)) 1)")) == 3);
+			test(gsym_error() == lisp_eval_string(l, "((lambda (x) (+ x 'a)) 1)"));
+		}
+
+		/*calls between compiled procedures are made on a stack on the
+		 *heap, not the C stack, which errors unwind along with it*/
+		test(is_proc(lisp_eval_string(l, "(define count-down (lambda (n) (if (= n 0) 0 (+ 1 (count-down (- n 1))))))")));
+		test(get_int(lisp_eval_string(l, "(count-down 100000)")) == 100000);
+		state(lisp_set_stack_limit(l, 1 << 16));
+		test(gsym_error() == lisp_eval_string(l, "(count-down 100000)"));
+		state(lisp_set_stack_limit(l, 1 << 26));
+		test(gsym_error() == lisp_eval_string(l, "(count-down 'a)"));
+		test(get_int(lisp_eval_string(l, "(count-down 1000)")) == 1000);
+
+		/*global variables are found through an inline cache, which
+		 *a new definition has to invalidate*/
+		test(get_int(lisp_eval_string(l, "(define cached 1)")) == 1);
+		test(is_proc(lisp_eval_string(l, "(define get-cached (lambda () cached))")));
+		test(is_proc(lisp_eval_string(l, "(define set-cached (lambda (x) (setq cached x)))")));
+		test(get_int(lisp_eval_string(l, "(get-cached)")) == 1);
+		test(get_int(lisp_eval_string(l, "(set-cached 2)")) == 2);
+		test(get_int(lisp_eval_string(l, "(get-cached)")) == 2);
+		test(get_int(lisp_eval_string(l, "(define cached 3)")) == 3);
+		test(get_int(lisp_eval_string(l, "(get-cached)")) == 3);
+		test(get_int(lisp_eval_string(l, "(set-cached 4)")) == 4);
+		test(get_int(lisp_eval_string(l, "cached")) == 4);
+
+		/*compile folds constants, removes dead branches and inlines
+		 *small compiled procedures, but leaves quoted data and the
+		 *arguments of F-expressions alone*/
+		test(get_int(car(get_proc_code(lisp_eval_string(l, "(compile \"\" () (+ 1 (* 2 3)))")))) == 7);
+		test(is_sym(car(get_proc_code(lisp_eval_string(l, "(compile \"\" (x) (if (< 1 2) x (undefined x)))")))));
+		test(is_proc(lisp_eval_string(l, "(define second (compile \"\" (x) (car (cdr x))))")));
+		test(is_subr(car(car(get_proc_code(lisp_eval_string(l, "(compile \"\" (y) (second y))"))))));
+		test(get_int(lisp_eval_string(l, "((compile \"\" (y) (second (cdr y))) '(1 2 3))")) == 3);
+		test(get_length(lisp_eval_string(l, "((compile \"\" () '(+ 1 2)))")) == 3);
+		test(is_fproc(lisp_eval_string(l, "(define quoting (flambda \"\" (x) (car x)))")));
+		test(get_length(lisp_eval_string(l, "((compile \"\" () (quoting (+ 1 2))))")) == 3);
+
+		/*special forms can be added from C*/
+		test(lisp_add_special_form(l, "unless", form_unless) == 0);
+		test(lisp_add_special_form(l, "if", form_unless) < 0);
+		test(get_int(lisp_eval_string(l, "(unless nil 1)")) == 1);
+		test(is_nil(lisp_eval_string(l, "(unless t (undefined-variable))")));
+		test(get_int(lisp_eval_string(l, "((lambda (x y) (unless x y)) nil 2)")) == 2);
+		test(get_int(lisp_eval_string(l, "((compile \"\" (x) (unless x 3)) nil)")) == 3);
+
 		test(!is_list(cons(l, gsym_tee(), gsym_tee())));
 		test(is_list(cons(l, gsym_tee(), gsym_nil())));
 		test(!is_list(cons(l, gsym_nil(), cons(l, gsym_tee(), gsym_tee()))));
 		test(is_list(mk_list(l, gsym_tee(), gsym_nil(), gsym_tee(), NULL)));
 
 		test(gsym_error() == lisp_eval_string(l, "(> 'a 1)"));
+
+		lisp_cell_t *sum = NULL;
+		/*the numeric primitives take any number of arguments, a float
+		 *makes the result a float, and only the result is allocated*/
+		test(get_int(lisp_eval_string(l, "(+ 1 2 3 4)")) == 10);
+		test(get_int(lisp_eval_string(l, "(+)")) == 0);
+		test(get_int(lisp_eval_string(l, "(* 2 3 4)")) == 24);
+		test(get_int(lisp_eval_string(l, "(- 5)")) == -5);
+		test(get_int(lisp_eval_string(l, "(- 10 1 2)")) == 7);
+		test(get_int(lisp_eval_string(l, "(/ 100 5 2)")) == 10);
+		test(is_floating(sum = lisp_eval_string(l, "(+ 1 2.5)")) && get_float(sum) == 3.5);
+		test(is_floating(sum = lisp_eval_string(l, "(* 2.5 2)")) && get_float(sum) == 5.0);
+		test(is_floating(sum = lisp_eval_string(l, "(/ 4.0)")) && get_float(sum) == 0.25);
+		test(gsym_error() == lisp_eval_string(l, "(/ 1 2 0)"));
+		test(gsym_error() == lisp_eval_string(l, "(+ 1 2 'a)"));
+		test(gsym_error() == lisp_eval_string(l, "(-)"));
+		test(gsym_tee() == lisp_eval_string(l, "(< 1 2 3)"));
+		test(gsym_nil() == lisp_eval_string(l, "(< 1 3 2)"));
+		test(gsym_tee() == lisp_eval_string(l, "(> 3 2.5 1)"));
+		test(gsym_tee() == lisp_eval_string(l, "(= 1 1.0 1)"));
+		test(is_nil(lisp_eval_string(l, "(eq 1 1.0)")));
+		test(gsym_tee() == lisp_eval_string(l, "(eq 1.5 1.5)"));
+		test(gsym_nil() == lisp_eval_string(l, "(= 1 1 2)"));
+		test(gsym_error() == lisp_eval_string(l, "(< 1 2 'a)"));
+		test(is_proc(lisp_eval_string(l, "(define sum-to (lambda (n acc) (if (= n 0) acc (sum-to (- n 1) (+ acc n 0.25 0.25)))))")));
+		size_t before = allocations(l);
+		test(is_floating(sum = lisp_eval_string(l, "(sum-to 10000 0)")) && get_float(sum) == 50005000.0 + 5000.0);
+		/*one environment and one float per call, not one float per addition*/
+		test(allocations(l) - before <= 2 * 10000 + 16);
 		test(is_sym(x));
 		test(is_asciiz(x));
 		test(!is_str(x));
 		test(gsym_error() == lisp_eval_string(l, "(eval (cons quote 0))"));
 
-		char *serial = NULL;
 		test(!strcmp((serial = lisp_serialize(l, cons(l, gsym_tee(), gsym_error()))), "(t . error)"));
 		state(free(serial));
+		/*lists that contain themselves are printed once*/
+		lisp_cell_t *loop = cons(l, gsym_tee(), gsym_nil());
+		state(set_car(loop, loop));
+		test((serial = lisp_serialize(l, loop)) && strstr(serial, "<recurse:") && strlen(serial) < 64);
+		state(free(serial));
+
+		/*marking must not recurse, this list is far longer than the C
+		 *stack allows and every element overflows the mark stack*/
+		lisp_cell_t *big = gsym_nil();
+		state(lisp_gc_off(l));
+		for (size_t i = 0; i < 10000000; i++)
+			big = cons(l, cons(l, gsym_nil(), gsym_nil()), big);
+		state(lisp_gc_on(l));
+		state(lisp_gc_mark(l, big));
+		state(lisp_gc_mark_and_sweep(l));
+		test(get_length(big) == 10000000);
+
+		const lisp_gc_stats_t *stats = lisp_gc_stats(l);
+		test(allocations(l) >= 20000000);
+		test(stats->collections > 0);
+		test(stats->mark_stack_max > 0);
+		test(stats->bytes_live > 0);
+		/*a cons is just its car and cdr, with no header*/
+		test(stats->bytes_live < 20000000 * (2 * sizeof(double) + sizeof(void *)));
+		test(stats->heap_peak >= stats->heap_bytes);
+		test(stats->pause_max <= stats->pause_total);
 
 		state(lisp_destroy(l));
 	}
@@ -89,6 +89,80 @@ uint32_t djb2(const char *s, size_t len) {
 	return h;
 }
 
+/**@brief multiply two numbers giving a 128 bit result, and replace them
+ * with its low and high halves exclusive-or'ed with their old values*/
+static void wymum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = *a;
+	r *= *b;
+	*a ^= (uint64_t)r;
+	*b ^= (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl, lo = t + (rm1 << 32);
+	c += lo < t;
+	*a ^= lo;
+	*b ^= rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t wymix(uint64_t a, uint64_t b) {
+	wymum(&a, &b);
+	return a ^ b;
+}
+
+static uint64_t wyr8(const uint8_t *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint64_t wyr4(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint64_t wyhash(const void *s, size_t len, uint64_t seed) {
+	static const uint64_t secret[4] = {
+		0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+		0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+	const uint8_t *p = s;
+	uint64_t a = 0, b = 0;
+	assert(s || !len);
+	seed ^= wymix(seed ^ secret[0], secret[1]);
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+			b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+		}
+	} else {
+		size_t i = len;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+				see1 = wymix(wyr8(p + 16) ^ secret[2], wyr8(p + 24) ^ see1);
+				see2 = wymix(wyr8(p + 32) ^ secret[3], wyr8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		for (; i > 16; i -= 16, p += 16)
+			seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+		a = wyr8(p + i - 16);
+		b = wyr8(p + i - 8);
+	}
+	a ^= secret[1];
+	b ^= seed;
+	wymum(&a, &b);
+	return wymix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
 char *getadelim(FILE * in, int delim) {
 	assert(in);
 	io_t io_in;
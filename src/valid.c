@@ -20,30 +20,37 @@
 #include <ctype.h>
 #include <assert.h>
 
+/* The format character, the name of the type for error messages, the
+ * check to perform and the types of object that always pass it. A type
+ * mask of zero means the check depends on more than the type. */
 #define LISP_VALIDATE_ARGS_XLIST\
-        X('s', "symbol",            is_sym(x))\
-        X('d', "integer",           is_int(x))\
-        X('c', "cons",              is_cons(x))\
-        X('L', "cons-or-nil",       is_cons(x) || is_nil(x))\
-        X('p', "procedure",         is_proc(x))\
-        X('r', "subroutine",        is_subr(x))\
-        X('S', "string",            is_str(x))\
-        X('P', "io-port",           is_io(x))\
-        X('h', "hash",              is_hash(x))\
-        X('F', "f-expr",            is_fproc(x))\
-        X('f', "float",             is_floating(x))\
-        X('u', "user-defined",      is_userdef(x))\
-        X('b', "t-or-nil",          is_nil(x) || x == gsym_tee())\
-        X('i', "input-port",        is_in(x))\
-        X('o', "output-port",       is_out(x))\
-        X('Z', "symbol-or-string",  is_asciiz(x))\
-        X('M', "symbol-or-cons",    is_cons(x) || is_sym(x))\
-        X('a', "integer-or-float",  is_arith(x))\
-        X('x', "function",          is_func(x))\
-        X('I', "input-port-or-string", is_in(x) || is_str(x))\
-        X('l', "defined-procedure", is_proc(x) || is_fproc(x))\
-        X('C', "symbol-string-or-integer", is_asciiz(x) || is_int(x))\
-        X('A', "any-expression",    1)
+        X('s', "symbol",            is_sym(x),      T(SYMBOL))\
+        X('d', "integer",           is_int(x),      T(INTEGER))\
+        X('c', "cons",              is_cons(x),     T(CONS))\
+        X('L', "cons-or-nil",       is_cons(x) || is_nil(x), 0)\
+        X('p', "procedure",         is_proc(x),     T(PROC))\
+        X('r', "subroutine",        is_subr(x),     T(SUBR))\
+        X('S', "string",            is_str(x),      T(STRING))\
+        X('P', "io-port",           is_io(x),       T(IO))\
+        X('h', "hash",              is_hash(x),     T(HASH))\
+        X('F', "f-expr",            is_fproc(x),    T(FPROC))\
+        X('f', "float",             is_floating(x), T(FLOAT))\
+        X('u', "user-defined",      is_userdef(x),  T(USERDEF))\
+        X('b', "t-or-nil",          is_nil(x) || x == gsym_tee(), 0)\
+        X('i', "input-port",        is_in(x),       0)\
+        X('o', "output-port",       is_out(x),      0)\
+        X('Z', "symbol-or-string",  is_asciiz(x),   T(SYMBOL) | T(STRING))\
+        X('M', "symbol-or-cons",    is_cons(x) || is_sym(x), T(SYMBOL) | T(CONS))\
+        X('a', "integer-or-float",  is_arith(x),    T(INTEGER) | T(FLOAT))\
+        X('x', "function",          is_func(x),     T(PROC) | T(FPROC) | T(SUBR))\
+        X('I', "input-port-or-string", is_in(x) || is_str(x), 0)\
+        X('l', "defined-procedure", is_proc(x) || is_fproc(x), T(PROC) | T(FPROC))\
+        X('C', "symbol-string-or-integer", is_asciiz(x) || is_int(x), T(SYMBOL) | T(STRING) | T(INTEGER))\
+        X('A', "any-expression",    1,              VALID_TYPES)
+
+#define T(TYPE)      ((uintptr_t)1 << (TYPE))
+#define VALID_TYPES  (((uintptr_t)1 << VALID_SHIFT) - 1) /**< type bits of a mask*/
+#define VALID_SHIFT  (24) /**< the format character is kept above the types*/
 
 static int print_type_string(lisp_t *l, const char *msg, unsigned len, const char *fmt, lisp_cell_t *args) {
         const char *s = NULL, *head = fmt;
@@ -57,7 +64,7 @@ static int print_type_string(lisp_t *l, const char *msg, unsigned len, const cha
                 s = "";
                 switch (c) {
                 case ' ': continue;
-#define X(CHAR, STRING, ACTION) case (CHAR): s = (STRING); break;
+#define X(CHAR, STRING, ACTION, TYPES) case (CHAR): s = (STRING); break;
                 LISP_VALIDATE_ARGS_XLIST
 #undef X
                 default: LISP_RECOVER(l, "\"invalid format string\" \"%s\" %S))", head, args);
@@ -79,15 +86,79 @@ size_t lisp_validate_arg_count(const char *fmt) {
 	return i;
 }
 
+int lisp_validate_compile(const char *fmt, cell_data_t *masks, size_t max) {
+	size_t n = 0;
+	uintptr_t types;
+	char c;
+	assert(fmt && masks);
+	while ((c = *fmt++)) {
+		switch (c) {
+		case ' ': continue;
+#define X(CHAR, STRING, ACTION, TYPES) case (CHAR): types = (TYPES); break;
+		LISP_VALIDATE_ARGS_XLIST
+#undef X
+		default: return 0;
+		}
+		if (n >= max) /*grouped format specifiers*/
+			return 0;
+		masks[n++].mask = types | ((uintptr_t)c << VALID_SHIFT);
+	}
+	return n == max;
+}
+
+/**@brief check an argument against a compiled mask, the type is tested
+ * first and the full check is only needed when that is not enough*/
+static int valid_mask(uintptr_t mask, lisp_cell_t *x) {
+	if (is_closed(x))
+		return 0;
+	if (mask & VALID_TYPES)
+		return !!(mask & T(TYPE(x)));
+	switch (mask >> VALID_SHIFT) {
+#define X(CHAR, STRING, ACTION, TYPES) case (CHAR): return ACTION;
+	LISP_VALIDATE_ARGS_XLIST
+#undef X
+	}
+	return 0;
+}
+
+static int validate_fail(lisp_t *l, lisp_cell_t *x, lisp_cell_t *args, int recover) {
+	char *msg = get_str(get_func_docstring(x));
+	print_type_string(l, msg, get_length(x), get_func_format(x), args);
+	if (recover)
+		lisp_throw(l, 1);
+	return 0;
+}
+
 int lisp_validate_cell(lisp_t * l, lisp_cell_t * x, lisp_cell_t * args, int recover) {
 	assert(x && is_func(x));
-	lisp_cell_t *ds = get_func_docstring(x);
+	lisp_cell_t *ds = get_func_docstring(x), *a = args;
+	cell_data_t *masks = is_subr(x) ? get_subr_masks(x) : NULL;
 	char *msg = get_str(ds);
 	msg = msg ? msg : "";
 	char *fmt = get_func_format(x);
 	if (!fmt)
 		return 1;	/*as there is no validation string, its up to the function */
-	return lisp_validate_args(l, msg, get_length(x), fmt, args, recover);
+	if (!masks)
+		return lisp_validate_args(l, msg, get_length(x), fmt, args, recover);
+	for (size_t i = 0, len = get_length(x); i < len; i++, a = cdr(a))
+		if (!is_cons(a) || !valid_mask(masks[i].mask, car(a)))
+			return validate_fail(l, x, args, recover);
+	return is_nil(a) ? 1 : validate_fail(l, x, args, recover);
+}
+
+int lisp_validate_argv(lisp_t *l, lisp_cell_t *x, size_t argc, lisp_cell_t **argv, int recover) {
+	assert(l && x && is_subr(x) && (argv || !argc));
+	cell_data_t *masks = get_subr_masks(x);
+	if (!get_func_format(x))
+		return 1;
+	if (!masks)
+		return lisp_validate_cell(l, x, lisp_argv_list(l, argc, argv), recover);
+	if (argc != get_length(x))
+		return validate_fail(l, x, lisp_argv_list(l, argc, argv), recover);
+	for (size_t i = 0; i < argc; i++)
+		if (!valid_mask(masks[i].mask, argv[i]))
+			return validate_fail(l, x, lisp_argv_list(l, argc, argv), recover);
+	return 1;
 }
 
 int lisp_validate_args(lisp_t * l, const char *msg, unsigned len, const char *fmt, lisp_cell_t * args, int recover) {
@@ -109,7 +180,7 @@ int lisp_validate_args(lisp_t * l, const char *msg, unsigned len, const char *fm
 		case ' ':
 			v = 1;
 			continue;
-#define X(CHAR, STRING, ACTION) case (CHAR): v = ACTION; break;
+#define X(CHAR, STRING, ACTION, TYPES) case (CHAR): v = ACTION; break;
 			LISP_VALIDATE_ARGS_XLIST
 #undef X
 		default:
@@ -0,0 +1,741 @@
+/** @file       vm.c
+ *  @brief      A byte code compiler and virtual machine for procedures
+ *  @author     Richard Howe (2015)
+ *  @license    LGPL v2.1 or Later
+ *  @email      howe.r.j.89@gmail.com
+ *
+ *  When a lambda is made its body is compiled to code for a small stack
+ *  machine, so the special forms are dispatched on once instead of every
+ *  time the body is evaluated. The compiler only handles the core special
+ *  forms, "if", "cond", "progn", "quote", "lambda", "let", "define", "setq"
+ *  and "while", and procedure calls, anything else leaves the procedure
+ *  uncompiled and eval() evaluates it as before.
+ *
+ *  Compiled code keeps to the same environment as eval(); the arguments of
+ *  a procedure are bound in a frame, a "let" binds its variables in a frame
+ *  of its own and global variables are found through the top level hash,
+ *  so compiled and evaluated procedures can call each other and share
+ *  closures. Variables bound within a compiled procedure are accessed by
+ *  position, anything else is looked up by name. Each of those look ups
+ *  has an inline cache of the binding it last found, see lookup(). The
+ *  operand stack is the
+ *  garbage collectors stack of temporary variables, so everything on it is
+ *  safe from collection.
+ *
+ *  F-expressions get their arguments unevaluated, it is not known until a
+ *  call is made whether the procedure called is one, so each call checks
+ *  before its arguments are evaluated.
+ *
+ *  A call from one compiled procedure to another does not recurse in C,
+ *  the frame of the callee is pushed on the same stack as the operands
+ *  with the address to return to and the frame of the caller, so deep
+ *  recursion is only limited by how large that stack is allowed to grow.
+ *  As it is the stack of temporary variables an error that unwinds to a
+ *  handler unwinds the calls along with it. **/
+
+#include "liblisp.h"
+#include "private.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO (1) /**< dispatch with a table of label addresses*/
+#endif
+
+/**@brief The instructions, their operands follow them in the code*/
+#define VM_OP_XLIST\
+	X(RETURN)   /**< return the top of the stack*/\
+	X(CONST)    /**< (index) push a constant*/\
+	X(NIL)      /**< push nil*/\
+	X(LOCAL0)   /**< (slot) push a variable in the current frame*/\
+	X(LOCAL)    /**< (depth slot) push a variable in an enclosing frame*/\
+	X(FREE)     /**< (depth index cache) push a variable not bound in the procedure*/\
+	X(SETLOCAL) /**< (depth slot) set a variable to the top of the stack*/\
+	X(SETFREE)  /**< (depth index cache) set a variable not bound in the procedure*/\
+	X(DEFINE)   /**< (index) define a global variable*/\
+	X(POP)      /**< drop the top of the stack*/\
+	X(JUMP)     /**< (address) jump*/\
+	X(JUMPNIL)  /**< (address) pop and jump if it was nil*/\
+	X(FEXPR)    /**< (index address) call an F-expression with its arguments unevaluated*/\
+	X(CALL)     /**< (count) call a procedure with arguments on the stack*/\
+	X(TAILCALL) /**< (count) call a procedure, replacing the current one*/\
+	X(CLOSURE)  /**< (index) make a procedure from a template*/\
+	X(LET)      /**< (index count) push a new frame for a let*/\
+	X(UNLET)    /**< pop the frame of a let*/
+
+#define X(OP) VM_ ## OP,
+typedef enum { VM_OP_XLIST VM_OP_LAST } vm_op_e;
+#undef X
+
+/**@brief The binding a variable not bound in a procedure was last found
+ * in, when looked up from the environment "env". The cells in it are not
+ * seen by the collector, they are kept alive by that environment.*/
+typedef struct {
+	lisp_cell_t *env,     /**< environment the look up started from*/
+		    *cell;    /**< cell holding the binding*/
+	size_t field;         /**< field of "cell" the value is in*/
+	unsigned version,     /**< "binding_version" when it was found*/
+		 epoch;       /**< "gc_epoch" when it was found*/
+} vm_cache_t;
+
+/**@brief Compiled code, held by a CODE cell which also has a list of the
+ * constants in it so they are seen by the garbage collector*/
+typedef struct {
+	size_t length;        /**< number of words of code*/
+	size_t nconsts;       /**< number of constants*/
+	size_t ncaches;       /**< number of inline caches*/
+	lisp_cell_t **consts; /**< constants, allocated after the code*/
+	vm_cache_t *caches;   /**< inline caches, allocated after the constants*/
+	unsigned code[];      /**< instructions and their operands*/
+} vm_code_t;
+
+/**@brief A frame that will exist when the code being compiled runs*/
+typedef struct vm_scope {
+	lisp_cell_t *syms;    /**< argument list or let variables naming each slot*/
+	size_t count,         /**< number of slots*/
+	       visible;       /**< slots bound so far, a let binds one at a time*/
+	struct vm_scope *up;  /**< enclosing frame*/
+} vm_scope_t;
+
+typedef struct {
+	lisp_t *l;
+	unsigned *code;       /**< code being generated*/
+	size_t used,          /**< words of code used*/
+	       allocated,     /**< words of code allocated*/
+	       nconsts,       /**< number of constants*/
+	       ncaches;       /**< number of inline caches*/
+	lisp_cell_t *consts;  /**< constants, in a list with a dummy head*/
+	lisp_cell_t *last;    /**< last cell in the constants list*/
+} vm_compiler_t;
+
+static int compile(vm_compiler_t *c, vm_scope_t *s, unsigned depth, lisp_cell_t *exp, int tail);
+
+/************************** compiler ******************************************/
+
+static size_t emit(vm_compiler_t *c, unsigned word) {
+	if (c->used >= c->allocated) {
+		unsigned *n = realloc(c->code, (c->allocated * 2 + 16) * sizeof(*n));
+		if (!n)
+			lisp_out_of_memory(c->l);
+		c->code = n;
+		c->allocated = c->allocated * 2 + 16;
+	}
+	c->code[c->used] = word;
+	return c->used++;
+}
+
+static void patch(vm_compiler_t *c, size_t at) {
+	c->code[at] = c->used;
+}
+
+/**@brief find or add a constant, returning its index*/
+static unsigned constant(vm_compiler_t *c, lisp_cell_t *x) {
+	unsigned i = 0;
+	for (lisp_cell_t *k = cdr(c->consts); is_cons(k); k = cdr(k), i++)
+		if (car(k) == x)
+			return i;
+	set_cdr(c->last, cons(c->l, x, c->l->nil));
+	c->last = cdr(c->last);
+	return c->nconsts++;
+}
+
+/**@brief find the frame and slot a variable will be in, if it is bound in
+ * the code being compiled, the last of any repeated symbols wins as it
+ * does for frame lookups in eval()
+ * @return int non-zero if found, otherwise "*depth" is the number of
+ *         frames to skip before looking it up by name*/
+static int resolve(vm_scope_t *s, lisp_cell_t *sym, unsigned *depth, unsigned *slot) {
+	for (*depth = 0; s; s = s->up, (*depth)++) {
+		lisp_cell_t *k = s->syms;
+		size_t i = 0;
+		int found = 0;
+		for (; is_cons(k) && i < s->visible; k = cdr(k), i++)
+			if (car(k) == sym) {
+				*slot = i;
+				found = 1;
+			}
+		if (!is_cons(k) && i < s->visible && k == sym) {
+			*slot = i;
+			found = 1;
+		}
+		if (found)
+			return 1;
+	}
+	return 0;
+}
+
+static int is_symbol_list(lisp_cell_t *x) {
+	for (; is_cons(x); x = cdr(x))
+		if (!is_sym(car(x)) || is_nil(car(x)))
+			return 0;
+	return is_nil(x) || is_sym(x);
+}
+
+static int compile_body(vm_compiler_t *c, vm_scope_t *s, unsigned depth, lisp_cell_t *body, int tail) {
+	if (is_nil(body)) {
+		emit(c, VM_NIL);
+		return 1;
+	}
+	for (; is_cons(cdr(body)); body = cdr(body)) {
+		if (!compile(c, s, depth, car(body), 0))
+			return 0;
+		emit(c, VM_POP);
+	}
+	return is_nil(cdr(body)) && compile(c, s, depth, car(body), tail);
+}
+
+/**@brief compile a procedure body into a CODE cell, the arguments are bound
+ * in a frame on top of "up" unless there are none
+ * @return lisp_cell_t* the code, or NULL if it could not be compiled*/
+static lisp_cell_t *compile_procedure(lisp_t *l, vm_scope_t *up, unsigned depth, lisp_cell_t *args, lisp_cell_t *body) {
+	vm_compiler_t c = { .l = l };
+	vm_scope_t s = { .syms = args, .count = frame_slots(args), .up = up };
+	lisp_cell_t *r = NULL;
+	vm_code_t *v;
+	size_t words;
+	if (depth > MAX_RECURSION_DEPTH)
+		LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", depth);
+	if (!is_symbol_list(args) || s.count > GC_MAX_FIELDS - FRAME_HEADER)
+		return NULL;
+	s.visible = s.count;
+	c.consts = c.last = lisp_gc_add(l, cons(l, l->nil, l->nil));
+	if (compile_body(&c, s.count ? &s : up, depth, body, 1)) {
+		emit(&c, VM_RETURN);
+		words = (c.used + 1) & ~(size_t)1; /* keep the constants aligned */
+		if (!(v = malloc(sizeof(*v) + words * sizeof(v->code[0]) + c.nconsts * sizeof(v->consts[0]) + c.ncaches * sizeof(v->caches[0]))))
+			lisp_out_of_memory(l);
+		v->length = c.used;
+		v->nconsts = c.nconsts;
+		v->ncaches = c.ncaches;
+		v->consts = (lisp_cell_t **)(v->code + words);
+		v->caches = (vm_cache_t *)(v->consts + c.nconsts);
+		memset(v->caches, 0, c.ncaches * sizeof(v->caches[0]));
+		memcpy(v->code, c.code, c.used * sizeof(v->code[0]));
+		r = cdr(c.consts);
+		for (size_t i = 0; i < c.nconsts; i++, r = cdr(r))
+			v->consts[i] = car(r);
+		r = mk_code(l, v, cdr(c.consts));
+	}
+	free(c.code);
+	return r;
+}
+
+static int compile_variable(vm_compiler_t *c, vm_scope_t *s, lisp_cell_t *sym, int set) {
+	unsigned depth = 0, slot = 0;
+	if (resolve(s, sym, &depth, &slot)) {
+		if (!set && !depth) {
+			emit(c, VM_LOCAL0);
+		} else {
+			emit(c, set ? VM_SETLOCAL : VM_LOCAL);
+			emit(c, depth);
+		}
+		emit(c, slot);
+	} else {
+		emit(c, set ? VM_SETFREE : VM_FREE);
+		emit(c, depth);
+		emit(c, constant(c, sym));
+		emit(c, c->ncaches++);
+	}
+	return 1;
+}
+
+static int compile_lambda(vm_compiler_t *c, vm_scope_t *s, unsigned depth, lisp_cell_t *exp) {
+	lisp_t *l = c->l;
+	lisp_cell_t *doc = l->empty_docstr, *code;
+	if (get_length(exp) < 2)
+		return 0;
+	if (is_str(car(exp))) {
+		doc = car(exp);
+		exp = cdr(exp);
+	}
+	if (!is_cons(cdr(exp)))
+		return 0;
+	code = compile_procedure(l, s, depth + 1, car(exp), cdr(exp));
+	emit(c, VM_CLOSURE);
+	emit(c, constant(c, mk_list(l, car(exp), cdr(exp), doc, code ? code : l->nil, NULL)));
+	return 1;
+}
+
+static int compile_let(vm_compiler_t *c, vm_scope_t *s, unsigned depth, lisp_cell_t *exp, int tail) {
+	lisp_t *l = c->l;
+	vm_scope_t let = { .up = s };
+	lisp_cell_t *b, *syms = NULL, *last = NULL;
+	unsigned up, slot;
+	size_t i;
+	if (get_length(exp) < 2)
+		return 0;
+	for (b = exp; is_cons(cdr(b)); b = cdr(b), let.count++) {
+		if (!is_cons(car(b)) || !lisp_check_length(car(b), 2) || !is_sym(CAAR(b)) || is_nil(CAAR(b)))
+			return 0;
+		let.syms = syms;
+		let.visible = let.count;
+		if (let.count && resolve(&let, CAAR(b), &up, &slot) && !up)
+			return 0; /* repeated variables are left to eval() */
+		if (!syms) {
+			syms = last = lisp_gc_add(l, cons(l, CAAR(b), l->nil));
+		} else {
+			set_cdr(last, cons(l, CAAR(b), l->nil));
+			last = cdr(last);
+		}
+	}
+	if (let.count > GC_MAX_FIELDS - FRAME_HEADER)
+		return 0;
+	let.syms = syms;
+	emit(c, VM_LET);
+	emit(c, constant(c, syms));
+	emit(c, let.count);
+	for (i = 0, b = exp; i < let.count; b = cdr(b), i++) {
+		let.visible = i + 1; /* a variable can refer to itself, see eval()*/
+		if (!compile(c, &let, depth + 1, CADAR(b), 0))
+			return 0;
+		emit(c, VM_SETLOCAL);
+		emit(c, 0);
+		emit(c, i);
+		emit(c, VM_POP);
+	}
+	if (!compile(c, &let, depth + 1, car(b), tail))
+		return 0;
+	emit(c, VM_UNLET);
+	return 1;
+}
+
+static int compile_call(vm_compiler_t *c, vm_scope_t *s, unsigned depth, lisp_cell_t *exp, int tail) {
+	lisp_cell_t *op = car(exp);
+	size_t skip, n = 0;
+	/* eval() evaluates a computed operator twice, so a quoted symbol is
+	 * a reference to a variable looked up when the call is made */
+	if (is_cons(op) && car(op) == c->l->quote && lisp_check_length(op, 2) && is_sym(CADR(op))) {
+		if (!compile_variable(c, s, CADR(op), 0))
+			return 0;
+	} else if (!compile(c, s, depth + 1, op, 0)) {
+		return 0;
+	}
+	emit(c, VM_FEXPR);
+	emit(c, constant(c, cdr(exp)));
+	skip = emit(c, 0);
+	for (exp = cdr(exp); is_cons(exp); exp = cdr(exp), n++)
+		if (!compile(c, s, depth + 1, car(exp), 0))
+			return 0;
+	emit(c, tail ? VM_TAILCALL : VM_CALL);
+	emit(c, n);
+	patch(c, skip);
+	return 1;
+}
+
+/**@brief compile an expression, leaving its value on the stack
+ * @return int zero if it uses something the compiler does not handle*/
+static int compile(vm_compiler_t *c, vm_scope_t *s, unsigned depth, lisp_cell_t *exp, int tail) {
+	lisp_t *l = c->l;
+	lisp_cell_t *first, *args;
+	size_t jump, end;
+	if (depth > MAX_RECURSION_DEPTH)
+		LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", depth);
+	if (is_nil(exp)) {
+		emit(c, VM_NIL);
+		return 1;
+	}
+	if (TYPE(exp) == LEXICAL) /* the compiler does its own addressing */
+		exp = exp->p[0].v;
+	if (is_sym(exp))
+		return compile_variable(c, s, exp, 0);
+	if (!is_cons(exp)) {
+		emit(c, VM_CONST);
+		emit(c, constant(c, exp));
+		return 1;
+	}
+	if (!is_proper_cons(exp))
+		return 0;
+	first = car(exp);
+	args = cdr(exp);
+	if (first == l->quote) {
+		if (!is_cons(args))
+			return 0;
+		emit(c, VM_CONST);
+		emit(c, constant(c, car(args)));
+		return 1;
+	}
+	if (first == l->iif) {
+		if (!lisp_check_length(args, 3) || !compile(c, s, depth + 1, car(args), 0))
+			return 0;
+		emit(c, VM_JUMPNIL);
+		jump = emit(c, 0);
+		if (!compile(c, s, depth + 1, CADR(args), tail))
+			return 0;
+		emit(c, VM_JUMP);
+		end = emit(c, 0);
+		patch(c, jump);
+		if (!compile(c, s, depth + 1, CADDR(args), tail))
+			return 0;
+		patch(c, end);
+		return 1;
+	}
+	if (first == l->cond) {
+		size_t ends[get_length(args) + 1], n = 0;
+		for (; is_cons(args); args = cdr(args)) {
+			if (!is_cons(car(args)) || !lisp_check_length(car(args), 2))
+				return 0;
+			if (!compile(c, s, depth + 1, CAAR(args), 0))
+				return 0;
+			emit(c, VM_JUMPNIL);
+			jump = emit(c, 0);
+			if (!compile(c, s, depth + 1, CADAR(args), tail))
+				return 0;
+			emit(c, VM_JUMP);
+			ends[n++] = emit(c, 0);
+			patch(c, jump);
+		}
+		emit(c, VM_NIL);
+		while (n)
+			patch(c, ends[--n]);
+		return 1;
+	}
+	if (first == l->progn)
+		return compile_body(c, s, depth + 1, args, tail);
+	if (first == l->lambda)
+		return compile_lambda(c, s, depth + 1, args);
+	if (first == l->let)
+		return compile_let(c, s, depth + 1, args, tail);
+	if (first == l->define) {
+		if (!lisp_check_length(args, 2) || !is_sym(car(args)))
+			return 0;
+		if (!compile(c, s, depth + 1, CADR(args), 0))
+			return 0;
+		emit(c, VM_DEFINE);
+		emit(c, constant(c, car(args)));
+		return 1;
+	}
+	if (first == l->setq) {
+		lisp_cell_t *sym = car(args);
+		if (!lisp_check_length(args, 2))
+			return 0;
+		if (TYPE(sym) == LEXICAL)
+			sym = sym->p[0].v;
+		if (!is_sym(sym) || !compile(c, s, depth + 1, CADR(args), 0))
+			return 0;
+		return compile_variable(c, s, sym, 1);
+	}
+	if (first == l->dowhile) {
+		size_t loop = c->used;
+		if (!is_cons(args) || !compile(c, s, depth + 1, car(args), 0))
+			return 0;
+		emit(c, VM_JUMPNIL);
+		end = emit(c, 0);
+		for (args = cdr(args); is_cons(args); args = cdr(args)) {
+			if (!compile(c, s, depth + 1, car(args), 0))
+				return 0;
+			emit(c, VM_POP);
+		}
+		emit(c, VM_JUMP);
+		emit(c, loop);
+		patch(c, end);
+		emit(c, VM_NIL);
+		return 1;
+	}
+	if (is_sym(first) && first->form != FORM_NONE)
+		return 0; /* flambda, compile, macro and forms added by modules */
+	return compile_call(c, s, depth + 1, exp, tail);
+}
+
+int vm_compile(lisp_t *l, lisp_cell_t *proc) {
+	assert(l && proc && is_proc(proc));
+	size_t gc_stack_save = l->gc_stack_used;
+	lisp_cell_t *code;
+	if (get_proc_bytecode(proc))
+		return 1;
+	code = compile_procedure(l, NULL, 0, get_proc_args(proc), get_proc_code(proc));
+	l->gc_stack_used = gc_stack_save;
+	if (!code)
+		return 0;
+	proc->p[5].v = code;
+	lisp_gc_write_barrier(proc);
+	return 1;
+}
+
+/************************** virtual machine ***********************************/
+
+/* Every cell made is also pushed onto the stack to protect it from the
+ * collector, instructions that allocate restore the stack pointer so that
+ * the operands of a call stay where it expects them. */
+#define PUSH(X)  lisp_gc_add(l, (X))
+#define POP()    (l->gc_stack[--l->gc_stack_used])
+#define TOP()    (l->gc_stack[l->gc_stack_used - 1])
+#define SP       (l->gc_stack_used)
+#define OPERAND  (code[ip++])
+#define VM_FRAME (4) /**< procedure, environment, return address and caller*/
+
+/**@brief make a list of the values on the stack from "at" onwards*/
+static lisp_cell_t *stack_list(lisp_t *l, size_t at) {
+	lisp_cell_t *r = l->nil;
+	for (size_t i = SP; i-- > at;)
+		r = cons(l, l->gc_stack[i], r);
+	return r;
+}
+
+/**@brief bind the "argc" values on the stack at "at" to the arguments of a
+ * procedure in the same way env_bind() does*/
+static lisp_cell_t *stack_bind(lisp_t *l, lisp_cell_t *proc, size_t at, size_t argc) {
+	lisp_cell_t *syms = get_proc_args(proc), *s, *f, *env = get_proc_env(proc);
+	size_t n = frame_slots(syms), fixed = 0, i;
+	if (n > GC_MAX_FIELDS - FRAME_HEADER)
+		f = env_bind(l, syms, stack_list(l, at), env);
+	else if (n) {
+		for (s = syms; is_cons(s); s = cdr(s))
+			fixed++;
+		if (argc < fixed)
+			f = NULL;
+		else {
+			lisp_cell_t *rest = fixed < n ? stack_list(l, at + fixed) : l->nil;
+			f = mk_frame(l, syms, n, env);
+			for (i = 0; i < fixed; i++)
+				f->p[FRAME_HEADER + i].v = l->gc_stack[at + i];
+			if (fixed < n)
+				f->p[FRAME_HEADER + fixed].v = rest;
+		}
+	} else
+		f = env;
+	if (!f)
+		LISP_RECOVER(l, "%y'argument-count-error%t\n %S\n '%S", proc, stack_list(l, at));
+	return f;
+}
+
+static lisp_cell_t *frame_at(lisp_cell_t *env, unsigned depth) {
+	for (; depth; depth--)
+		env = get_frame_parent(env);
+	return env;
+}
+
+/**@brief look up a variable by name from "env", or use the binding in an
+ * inline cache if it was found from the same environment. A binding can
+ * only be shadowed by a new global definition or by inserting into a
+ * hash, which change "binding_version", and the address of "env" could
+ * only be reused after a collection, which changes "gc_epoch".
+ * @return vm_cache_t* the cache, holding the binding, or NULL if unbound*/
+static vm_cache_t *lookup(lisp_t *l, vm_cache_t *k, lisp_cell_t *env, lisp_cell_t *sym) {
+	if (k->env != env || k->version != l->binding_version || k->epoch != l->gc_epoch) {
+		if (!(k->cell = env_lookup(l, sym, env, &k->field))) {
+			k->env = NULL;
+			return NULL;
+		}
+		k->env = env;
+		k->version = l->binding_version;
+		k->epoch = l->gc_epoch;
+	}
+	return k;
+}
+
+lisp_cell_t *vm_run(lisp_t *l, unsigned depth, lisp_cell_t *proc, lisp_cell_t *env) {
+	assert(l && proc && env && get_proc_bytecode(proc));
+	const size_t entry = SP;
+	size_t base = SP;
+	vm_code_t *v = get_raw(get_proc_bytecode(proc));
+	const unsigned *code = v->code;
+	lisp_cell_t **consts = v->consts, *x, *f;
+	vm_cache_t *k;
+	size_t ip = 0, n, sp;
+	unsigned d;
+#ifdef VM_COMPUTED_GOTO
+#define X(OP) __extension__ && op_ ## OP,
+	static void *dispatch[] = { VM_OP_XLIST };
+#undef X
+#define VM_CASE(OP) op_ ## OP
+#define NEXT        __extension__ ({ goto *dispatch[code[ip++]]; })
+#else
+#define VM_CASE(OP) case VM_ ## OP
+#define NEXT        goto next
+#endif
+	if (depth > MAX_RECURSION_DEPTH)
+		LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", depth);
+	PUSH(proc);
+	PUSH(env);
+	PUSH(MK_FIXNUM(0));
+	PUSH(MK_FIXNUM(base));
+#define ENV (l->gc_stack[base + 1])
+#ifdef VM_COMPUTED_GOTO
+	NEXT;
+#else
+next:
+	switch (code[ip++])
+#endif
+	{
+	VM_CASE(RETURN):
+		x = TOP();
+	ret:
+		SP = base;
+		if (base == entry)
+			return PUSH(x);
+		ip = GET_FIXNUM(l->gc_stack[base + 2]);
+		base = GET_FIXNUM(l->gc_stack[base + 3]);
+		v = get_raw(get_proc_bytecode(l->gc_stack[base]));
+		code = v->code;
+		consts = v->consts;
+		PUSH(x);
+		NEXT;
+	VM_CASE(CONST):
+		PUSH(consts[OPERAND]);
+		NEXT;
+	VM_CASE(NIL):
+		PUSH(l->nil);
+		NEXT;
+	VM_CASE(LOCAL0):
+		PUSH(get_frame_value(ENV, OPERAND));
+		NEXT;
+	VM_CASE(LOCAL):
+		d = OPERAND;
+		PUSH(get_frame_value(frame_at(ENV, d), OPERAND));
+		NEXT;
+	VM_CASE(FREE):
+		d = OPERAND;
+		x = consts[OPERAND];
+		if (!(k = lookup(l, &v->caches[OPERAND], frame_at(ENV, d), x)))
+			LISP_RECOVER(l, "%r\"unbound symbol\"\n %y'%s%t", get_sym(x));
+		PUSH(CELL_FIELDS(k->cell)[k->field].v);
+		NEXT;
+	VM_CASE(SETLOCAL):
+		d = OPERAND;
+		f = frame_at(ENV, d);
+		f->p[FRAME_HEADER + OPERAND].v = TOP();
+		lisp_gc_write_barrier(f);
+		NEXT;
+	VM_CASE(SETFREE):
+		d = OPERAND;
+		x = consts[OPERAND];
+		if (!(k = lookup(l, &v->caches[OPERAND], frame_at(ENV, d), x)))
+			LISP_RECOVER(l, "%y'setq\n %r\"undefined variable\"%t\n '%S", x);
+		CELL_FIELDS(k->cell)[k->field].v = TOP();
+		lisp_gc_write_barrier(k->cell);
+		NEXT;
+	VM_CASE(DEFINE):
+		sp = SP;
+		lisp_extend_top(l, consts[OPERAND], TOP());
+		SP = sp;
+		NEXT;
+	VM_CASE(POP):
+		(void)POP();
+		NEXT;
+	VM_CASE(JUMP):
+		n = OPERAND;
+		if (n < ip && l->sig) {
+			l->sig = 0;
+			lisp_throw(l, 1);
+		}
+		ip = n;
+		NEXT;
+	VM_CASE(JUMPNIL):
+		n = OPERAND;
+		if (is_nil(POP()))
+			ip = n;
+		NEXT;
+	VM_CASE(FEXPR):
+		x = consts[OPERAND];
+		n = OPERAND;
+		if (!is_fproc(TOP()))
+			NEXT;
+		f = TOP();
+		sp = SP;
+		l->cur_depth = depth;
+		l->cur_env = ENV;
+		if (!(env = env_bind(l, get_proc_args(f), cons(l, x, l->nil), get_proc_env(f))))
+			LISP_RECOVER(l, "%y'argument-count-error%t\n %S\n '%S", f, x);
+		x = eval_body(l, depth + 1, get_proc_code(f), env);
+		SP = sp;
+		TOP() = x;
+		ip = n;
+		NEXT;
+	VM_CASE(TAILCALL):
+	VM_CASE(CALL):
+	{
+		int tail = code[ip - 1] == VM_TAILCALL;
+		size_t at = SP - OPERAND;
+		lisp_cell_t *op = l->gc_stack[at - 1];
+		x = NULL;
+		if (l->sig) {
+			l->sig = 0;
+			lisp_throw(l, 1);
+		}
+		l->cur_depth = depth;
+		l->cur_env = ENV;
+		if (is_proc(op) && get_proc_bytecode(op)) {
+			f = stack_bind(l, op, at, SP - at);
+			if (tail) { /* reuse this call to run the new procedure */
+				l->gc_stack[base] = op;
+				ENV = f;
+				SP = base + VM_FRAME;
+			} else { /* the callee replaces its operands on the stack */
+				if (SP > l->stack_limit / sizeof(*l->gc_stack))
+					LISP_RECOVER(l, "%y'recursion-depth-reached%t %d", (intptr_t)SP);
+				n = base;
+				base = SP = at - 1;
+				PUSH(op);
+				PUSH(f);
+				PUSH(MK_FIXNUM(ip));
+				PUSH(MK_FIXNUM(n));
+			}
+			v = get_raw(get_proc_bytecode(op));
+			code = v->code;
+			consts = v->consts;
+			ip = 0;
+			NEXT;
+		} else if (is_vsubr(op)) { /* the operand stack moves when cells are made */
+			size_t argc = SP - at, a = lisp_args_reserve(l, argc);
+			memcpy(l->args + a, l->gc_stack + at, argc * sizeof(*l->args));
+			lisp_validate_argv(l, op, argc, l->args + a, 1);
+			x = (*get_vsubr(op)) (l, argc, l->args + a);
+			l->args_used = a;
+		} else if (is_subr(op)) {
+			lisp_cell_t *vals = stack_list(l, at);
+			lisp_validate_cell(l, op, vals, 1);
+			x = (*get_subr(op)) (l, vals);
+		} else if (is_proc(op)) {
+			if (!(f = env_bind(l, get_proc_args(op), stack_list(l, at), get_proc_env(op))))
+				LISP_RECOVER(l, "%y'argument-count-error%t\n %S\n '%S", op, stack_list(l, at));
+			x = eval_body(l, depth + 1, get_proc_code(op), f);
+		} else {
+			LISP_RECOVER(l, "%r\"not a procedure\"%t\n '%S", op);
+		}
+		SP = at - 1;
+		PUSH(x);
+		if (tail) /* return from this procedure as well */
+			goto ret;
+		NEXT;
+	}
+	VM_CASE(CLOSURE): /* the template is (args body doc code) */
+		f = consts[OPERAND];
+		sp = SP;
+		x = mk_proc(l, car(f), CADR(f), ENV, CADDR(f));
+		if (!is_nil(CADDDR(f)))
+			x->p[5].v = CADDDR(f);
+		SP = sp;
+		PUSH(x);
+		NEXT;
+	VM_CASE(LET):
+		x = consts[OPERAND];
+		n = OPERAND;
+		sp = SP;
+		ENV = mk_frame(l, x, n, ENV);
+		SP = sp;
+		NEXT;
+	VM_CASE(UNLET):
+		ENV = get_frame_parent(ENV);
+		NEXT;
+#ifndef VM_COMPUTED_GOTO
+	default:
+		FATAL("internal inconsistency: unknown instruction");
+#endif
+	}
+	FATAL("internal inconsistency: reached the unreachable");
+	return NULL;
+#undef ENV
+#undef VM_CASE
+#undef NEXT
+}
+
+void lisp_set_vm(lisp_t *l, int on) {
+	assert(l);
+	l->vm_on = !!on;
+}
+
+void lisp_set_stack_limit(lisp_t *l, size_t bytes) {
+	assert(l);
+	l->stack_limit = bytes;
+}